@@ -3,18 +3,102 @@
 
 #include <array>
 #include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
-//#define TAPERED 1
-
 using tune_t = double;
 
-#if TAPERED
-using pair_t = std::array<tune_t, 2>;
-using parameters_t = std::vector<pair_t>;
-#else
-using parameters_t = std::vector<tune_t>;
-#endif
+// Stage weights of an untapered eval, every coefficient counts fully
+struct UnitWeights
+{
+    constexpr tune_t operator[](int32_t) const
+    {
+        return 1;
+    }
+
+    bool operator==(const UnitWeights&) const = default;
+};
+
+// How a parameter is split over the game phase. Every parameter has one value per stage, stage 0
+// being the midgame and the last stage the endgame, and a position's eval is the sum over stages
+// weighted by get_weights. Every engine declares its phase model as phase_model_t, and the tuner kernels
+// are specialized on its stage count, so untapered engines don't pay for tapering.
+template<int32_t StageCount>
+struct PhaseModel
+{
+    static_assert(StageCount >= 1, "A phase model needs at least one stage");
+
+    static constexpr int32_t stage_count = StageCount;
+    static constexpr bool tapered = StageCount > 1;
+    static constexpr int32_t max_phase = 24;
+
+    using parameter_t = std::conditional_t<tapered, std::array<tune_t, StageCount>, tune_t>;
+    using weights_t = std::conditional_t<tapered, std::array<tune_t, StageCount>, UnitWeights>;
+
+    static constexpr tune_t& get(parameter_t& parameter, [[maybe_unused]] const int32_t stage)
+    {
+        if constexpr (tapered)
+        {
+            return parameter[stage];
+        }
+        else
+        {
+            return parameter;
+        }
+    }
+
+    static constexpr tune_t get(const parameter_t& parameter, [[maybe_unused]] const int32_t stage)
+    {
+        if constexpr (tapered)
+        {
+            return parameter[stage];
+        }
+        else
+        {
+            return parameter;
+        }
+    }
+
+    // Phase is max_phase with all pieces on the board and 0 with only kings and pawns. Stages are spread
+    // evenly over the phase and interpolated linearly, the endgame scale applies to the last stage only.
+    static constexpr weights_t get_weights([[maybe_unused]] const int32_t phase, [[maybe_unused]] const tune_t endgame_scale)
+    {
+        weights_t weights{};
+        if constexpr (StageCount == 2)
+        {
+            weights[0] = phase / static_cast<tune_t>(max_phase);
+            weights[1] = (max_phase - phase) / static_cast<tune_t>(max_phase) * endgame_scale;
+        }
+        else if constexpr (tapered)
+        {
+            auto position = (max_phase - phase) * (StageCount - 1) / static_cast<tune_t>(max_phase);
+            position = position < 0 ? 0 : position > StageCount - 1 ? StageCount - 1 : position;
+            const auto lower = static_cast<int32_t>(position) < StageCount - 1 ? static_cast<int32_t>(position) : StageCount - 2;
+            weights[lower] = 1 - (position - lower);
+            weights[lower + 1] = position - lower;
+            weights[StageCount - 1] *= endgame_scale;
+        }
+        return weights;
+    }
+};
+
+// None of the bundled engines uses more than two stages, so the interpolation is checked here
+static_assert(PhaseModel<3>::get_weights(PhaseModel<3>::max_phase, 1) == std::array<tune_t, 3>{ 1, 0, 0 });
+static_assert(PhaseModel<3>::get_weights(PhaseModel<3>::max_phase / 2, 1) == std::array<tune_t, 3>{ 0, 1, 0 });
+static_assert(PhaseModel<3>::get_weights(0, 0.5) == std::array<tune_t, 3>{ 0, 0, 0.5 });
+
+using UntaperedPhase = PhaseModel<1>;
+using TaperedPhase = PhaseModel<2>;
+
+template<typename Phase>
+using Parameters = std::vector<typename Phase::parameter_t>;
+
+// Midgame and endgame value of a parameter of a tapered engine
+using pair_t = TaperedPhase::parameter_t;
 
 using coefficients_t = std::vector<int16_t>;
 
@@ -25,50 +109,124 @@ struct EvalResult
     tune_t endgame_scale = 1;
 };
 
-#if TAPERED
+// Results of a batched eval, written by the engine into buffers which the tuner reuses between batches.
+// The sparse coefficients of position i are values and indices in [offsets[i], offsets[i + 1]).
+struct EvalBatch
+{
+    std::vector<int16_t> values;
+    std::vector<int16_t> indices;
+    std::vector<uint32_t> offsets{ 0 };
+    std::vector<tune_t> scores;
+    std::vector<tune_t> endgame_scales;
+
+    void clear(const int32_t parameter_count)
+    {
+        values.clear();
+        indices.clear();
+        offsets.assign(1, 0);
+        scores.clear();
+        endgame_scales.clear();
+        expected_count = parameter_count;
+        next_index = 0;
+    }
+
+    int32_t size() const
+    {
+        return static_cast<int32_t>(scores.size());
+    }
+
+    // Appends the coefficient of the next parameter of the current position, zeros are left out
+    void push_back(const int16_t value)
+    {
+        if (value != 0)
+        {
+            values.push_back(value);
+            indices.push_back(static_cast<int16_t>(next_index));
+        }
+        next_index++;
+    }
+
+    void end_position(const tune_t score, const tune_t endgame_scale = 1)
+    {
+        if (next_index != expected_count)
+        {
+            throw std::runtime_error("Parameter count mismatch");
+        }
+
+        offsets.push_back(static_cast<uint32_t>(values.size()));
+        scores.push_back(score);
+        endgame_scales.push_back(endgame_scale);
+        next_index = 0;
+    }
+
+private:
+    int32_t expected_count = 0;
+    int32_t next_index = 0;
+};
+
+// Named group of consecutive parameters, e.g. a PST, which can be selected by name in the tuner config
+struct ParameterRange
+{
+    std::string name;
+    int32_t begin;
+    int32_t size;
+    bool tapered = true;
+};
+
 enum class PhaseStages
 {
     Midgame = 0,
     Endgame = 1
 };
 
-constexpr int32_t S(const int32_t mg, const int32_t eg)
+// Midgame and endgame score of a tapered engine packed into one integer, which engines define their S with
+constexpr int32_t packed_score(const int32_t mg, const int32_t eg)
 {
     //return (eg << 16) + mg;
     return static_cast<int32_t>(static_cast<uint32_t>(eg) << 16) + mg;
 }
 
-static constexpr int32_t mg_score(int32_t score)
+constexpr int32_t mg_score(int32_t score)
 {
     return static_cast<int16_t>(score);
 }
 
-static constexpr int32_t eg_score(int32_t score)
+constexpr int32_t eg_score(int32_t score)
 {
     return static_cast<int16_t>((score + 0x8000) >> 16);
 }
-#else
-constexpr int32_t S(const int32_t mg, const int32_t eg)
+
+// Score of an untapered engine, for engines whose S is given a midgame and an endgame value
+constexpr int32_t averaged_score(const int32_t mg, const int32_t eg)
 {
     return (mg + eg)/2;
 }
-#endif
-
-template<typename T>
-void get_initial_parameter_single(parameters_t& parameters, const T& parameter)
-{
-#if TAPERED
-    const auto mg = mg_score(static_cast<int32_t>(parameter));
-    const auto eg = eg_score(static_cast<int32_t>(parameter));
-    const pair_t pair = { static_cast<double>(mg), static_cast<double>(eg) };
-    parameters.push_back(pair);
-#else
-    parameters.push_back(static_cast<tune_t>(parameter));
-#endif
+
+// Initial parameters are packed scores for tapered engines and plain values for untapered ones
+template<typename Parameter, typename T>
+void get_initial_parameter_single(std::vector<Parameter>& parameters, const T& parameter)
+{
+    if constexpr (std::is_same_v<Parameter, tune_t>)
+    {
+        parameters.push_back(static_cast<tune_t>(parameter));
+    }
+    else
+    {
+        // Stages between the midgame and the endgame start out interpolated between the two
+        constexpr auto stage_count = static_cast<int32_t>(std::tuple_size_v<Parameter>);
+        const auto mg = mg_score(static_cast<int32_t>(parameter));
+        const auto eg = eg_score(static_cast<int32_t>(parameter));
+        Parameter stages;
+        for (int32_t stage = 0; stage < stage_count; stage++)
+        {
+            stages[stage] = mg + static_cast<tune_t>(eg - mg) * stage / (stage_count - 1);
+        }
+        parameters.push_back(stages);
+    }
 }
 
-template<typename T>
-void get_initial_parameter_array(parameters_t& parameters, const T& parameter, const int size)
+template<typename Parameter, typename T>
+void get_initial_parameter_array(std::vector<Parameter>& parameters, const T& parameter, const int size)
 {
     for (int i = 0; i < size; i++)
     {
@@ -76,8 +234,8 @@ void get_initial_parameter_array(parameters_t& parameters, const T& parameter, c
     }
 }
 
-template<typename T>
-void get_initial_parameter_array_2d(parameters_t& parameters, const T& parameter, const int size1, const int size2)
+template<typename Parameter, typename T>
+void get_initial_parameter_array_2d(std::vector<Parameter>& parameters, const T& parameter, const int size1, const int size2)
 {
     for (int i = 0; i < size1; i++)
     {
@@ -86,14 +244,15 @@ void get_initial_parameter_array_2d(parameters_t& parameters, const T& parameter
 }
 
 
-template<typename T>
-void get_coefficient_single(coefficients_t& coefficients, const T& trace)
+// Coefficients can be written to a coefficients_t or to an EvalBatch
+template<typename Coefficients, typename T>
+void get_coefficient_single(Coefficients& coefficients, const T& trace)
 {
     coefficients.push_back(static_cast<int16_t>(trace[0] - trace[1]));
 }
 
-template<typename T>
-void get_coefficient_array(coefficients_t& coefficients, const T& trace, const int size)
+template<typename Coefficients, typename T>
+void get_coefficient_array(Coefficients& coefficients, const T& trace, const int size)
 {
     for (int i = 0; i < size; i++)
     {
@@ -101,8 +260,8 @@ void get_coefficient_array(coefficients_t& coefficients, const T& trace, const i
     }
 }
 
-template<typename T>
-void get_coefficient_array_2d(coefficients_t& coefficients, const T& trace, const int size1, const int size2)
+template<typename Coefficients, typename T>
+void get_coefficient_array_2d(Coefficients& coefficients, const T& trace, const int size1, const int size2)
 {
     for (int i = 0; i < size1; i++)
     {
@@ -110,4 +269,147 @@ void get_coefficient_array_2d(coefficients_t& coefficients, const T& trace, cons
     }
 }
 
+template<typename Coefficients, typename T>
+void get_trace_coefficients(Coefficients& coefficients, const T& trace)
+{
+    for (const auto& parameter_trace : trace)
+    {
+        get_coefficient_single(coefficients, parameter_trace);
+    }
+}
+
+enum class TermShape
+{
+    Single,
+    Array,
+    Array2d,
+    Pst
+};
+
+// Declaration of one evaluation term, e.g. a PST. The list of terms of an engine is its
+// parameter layout, from which offsets, traces, initial parameters and printing are derived.
+struct ParameterTerm
+{
+    std::string_view name;
+    TermShape shape;
+    int32_t size1 = 1;
+    int32_t size2 = 1;
+    // Printed as the size of array terms instead of size1
+    std::string_view size_name = "";
+    // Initial values in the score format of the engine, S(mg, eg) for tapered ones. Terms without them start at zero.
+    const int32_t* initial_values = nullptr;
+    // Untapered terms of tapered engines have one value for all stages
+    bool tapered = true;
+
+    constexpr int32_t size() const
+    {
+        return size1 * size2;
+    }
+};
+
+// Location of a term in the parameters, indexed like the term's shape
+struct TermIndex
+{
+    int32_t offset;
+    int32_t size2;
+
+    constexpr int32_t operator()() const
+    {
+        return offset;
+    }
+
+    constexpr int32_t operator()(const int32_t i) const
+    {
+        return offset + i;
+    }
+
+    constexpr int32_t operator()(const int32_t i, const int32_t j) const
+    {
+        return offset + i * size2 + j;
+    }
+};
+
+template<std::size_t TermCount>
+struct ParameterLayout
+{
+    std::array<ParameterTerm, TermCount> terms;
+
+    constexpr int32_t parameter_count() const
+    {
+        int32_t count = 0;
+        for (const auto& term : terms)
+        {
+            count += term.size();
+        }
+        return count;
+    }
+
+    // Fails to compile when used in a constant expression with an unknown name
+    constexpr TermIndex term(const std::string_view name) const
+    {
+        int32_t offset = 0;
+        for (const auto& term : terms)
+        {
+            if (term.name == name)
+            {
+                return TermIndex{ offset, term.size2 };
+            }
+            offset += term.size();
+        }
+        throw std::logic_error("Unknown parameter term");
+    }
+
+    std::vector<ParameterRange> get_ranges() const
+    {
+        std::vector<ParameterRange> ranges;
+        int32_t offset = 0;
+        for (const auto& term : terms)
+        {
+            ranges.push_back(ParameterRange{ std::string(term.name), offset, term.size(), term.tapered });
+            offset += term.size();
+        }
+        return ranges;
+    }
+
+    template<typename Phase>
+    Parameters<Phase> get_initial_parameters() const
+    {
+        Parameters<Phase> parameters;
+        for (const auto& term : terms)
+        {
+            for (int32_t i = 0; i < term.size(); i++)
+            {
+                get_initial_parameter_single(parameters, term.initial_values ? term.initial_values[i] : 0);
+            }
+        }
+        return parameters;
+    }
+
+    // Calls print_term(term, index) for every term, which has to advance index past the term
+    template<typename PrintTerm>
+    void print(PrintTerm&& print_term) const
+    {
+        int index = 0;
+        for (const auto& term : terms)
+        {
+            const auto term_end = index + term.size();
+            print_term(term, index);
+            if (index != term_end)
+            {
+                throw std::logic_error("Parameter term printed with the wrong size");
+            }
+        }
+    }
+};
+
+template<typename... Terms>
+constexpr auto make_parameter_layout(const Terms&... terms)
+{
+    return ParameterLayout<sizeof...(Terms)>{ { terms... } };
+}
+
+// Trace of every parameter for both colors, in the order of the parameter layout
+template<int32_t ParameterCount>
+using ParameterTrace = std::array<std::array<int32_t, 2>, ParameterCount>;
+
 #endif // !BASE_H
\ No newline at end of file
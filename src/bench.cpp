@@ -0,0 +1,587 @@
+#include "tuner.h"
+#include "dataset_generator.h"
+#include "fen_line.h"
+#include "external/chess.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace Tuner;
+
+// Every heap allocation of the benchmark is counted, to report the allocations per traced position
+static atomic<int64_t> allocation_count = 0;
+
+void* operator new(const size_t size)
+{
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    if (void* pointer = malloc(size == 0 ? 1 : size))
+    {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+// Fixed position set, a mix of openings, middlegames and endgames
+static const vector<string> bench_fens =
+{
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "rnbqkb1r/pp1p1ppp/4pn2/2p5/2PP4/2N5/PP2PPPP/R1BQKBNR w KQkq - 0 4",
+    "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP1B1PPP/R2QKB1R w KQ - 0 8",
+    "2r3k1/pp3ppp/4p3/3n4/3P4/P4N2/1P3PPP/2R3K1 b - - 0 25",
+    "8/5pk1/6p1/3R4/7P/6P1/r4PK1/8 w - - 0 45",
+    "6k1/5ppp/8/8/8/8/5PPP/3Q2K1 w - - 0 40",
+    "8/8/4k3/3p4/3P4/4K3/8/8 w - - 0 60",
+    "r2q1rk1/ppp2ppp/2np1n2/2b1p3/2B1P1b1/2NP1N2/PPP2PPP/R1BQ1RK1 b - - 5 7",
+    "4rrk1/pp1n1pp1/q5p1/P1pP4/2n3P1/7P/1P3PB1/R1BQ1RK1 w - - 3 22",
+    "r1b1k2r/ppppnppp/2n2q2/2b5/3NP3/2P1B3/PP3PPP/RN1QKB1R w KQkq - 0 1",
+    "3r2k1/p4ppp/1p6/8/3b4/1P3N2/P4PPP/4R1K1 b - - 0 30",
+};
+
+struct BenchResult
+{
+    string engine;
+    TracePath path;
+    TraceBenchResult trace;
+    double allocations_per_position;
+};
+
+static const char* get_path_name(const TracePath path)
+{
+    return path == TracePath::Fen ? "fen" : "external";
+}
+
+static BenchResult run_bench(const Engine& engine, const int32_t iterations, const TracePath path)
+{
+    BenchResult result;
+    result.engine = engine.name;
+    result.path = path;
+
+    // A run without iterations makes the same setup allocations, which leaves the ones made per position
+    const auto setup_start = allocation_count.load();
+    engine.bench_traces(bench_fens, 0, path);
+    const auto setup_allocations = allocation_count.load() - setup_start;
+
+    const auto start = allocation_count.load();
+    result.trace = engine.bench_traces(bench_fens, iterations, path);
+    const auto allocations = allocation_count.load() - start - setup_allocations;
+    result.allocations_per_position = result.trace.positions > 0 ? static_cast<double>(allocations) / result.trace.positions : 0;
+    return result;
+}
+
+static void print_results(const vector<BenchResult>& results)
+{
+    for (const auto& result : results)
+    {
+        cout << result.engine << " " << get_path_name(result.path) << ": ";
+        if (result.trace.positions == 0)
+        {
+            cout << "not supported" << endl;
+            continue;
+        }
+
+        cout << static_cast<int64_t>(result.trace.positions / result.trace.seconds) << " positions/s, ";
+        cout << result.allocations_per_position << " allocations/position, checksum " << result.trace.checksum << endl;
+    }
+}
+
+static void print_results_json(const vector<BenchResult>& results, const int32_t iterations)
+{
+    cout << "{" << endl;
+    cout << "  \"positions\": " << bench_fens.size() << "," << endl;
+    cout << "  \"iterations\": " << iterations << "," << endl;
+    cout << "  \"results\": [";
+    bool first = true;
+    for (const auto& result : results)
+    {
+        if (result.trace.positions == 0)
+        {
+            continue;
+        }
+
+        cout << (first ? "" : ",") << endl;
+        cout << "    { \"engine\": \"" << result.engine << "\", \"path\": \"" << get_path_name(result.path) << "\"";
+        cout << ", \"positions_per_second\": " << static_cast<int64_t>(result.trace.positions / result.trace.seconds);
+        cout << ", \"allocations_per_position\": " << result.allocations_per_position;
+        cout << ", \"checksum\": " << result.trace.checksum << " }";
+        first = false;
+    }
+    cout << endl << "  ]" << endl << "}" << endl;
+}
+
+static void print_tuning_results(const vector<pair<string, TuningBenchResult>>& results)
+{
+    for (const auto& [engine, result] : results)
+    {
+        cout << engine << ": " << result.entries << " entries, ";
+        cout << static_cast<int64_t>(result.entries / result.load_seconds) << " entries/s loading, ";
+        cout << result.bytes_per_entry << " bytes/entry" << endl;
+        for (const auto& scaling : result.scaling)
+        {
+            cout << "  " << scaling.threads << " threads: " << scaling.epochs_per_second << " epochs/s" << endl;
+        }
+    }
+}
+
+static void print_tuning_results_json(const vector<pair<string, TuningBenchResult>>& results, const int32_t epochs)
+{
+    cout << "{" << endl;
+    cout << "  \"epochs\": " << epochs << "," << endl;
+    cout << "  \"results\": [";
+    bool first = true;
+    for (const auto& [engine, result] : results)
+    {
+        cout << (first ? "" : ",") << endl;
+        cout << "    { \"engine\": \"" << engine << "\", \"entries\": " << result.entries;
+        cout << ", \"entries_per_second\": " << static_cast<int64_t>(result.entries / result.load_seconds);
+        cout << ", \"bytes_per_entry\": " << result.bytes_per_entry << ", \"scaling\": [";
+        for (size_t scaling_index = 0; scaling_index < result.scaling.size(); scaling_index++)
+        {
+            const auto& scaling = result.scaling[scaling_index];
+            cout << (scaling_index == 0 ? "" : ", ") << "{ \"threads\": " << scaling.threads << ", \"epochs_per_second\": " << scaling.epochs_per_second << " }";
+        }
+        cout << "] }";
+        first = false;
+    }
+    cout << endl << "  ]" << endl << "}" << endl;
+}
+
+// The string based line parsing which parse_fen_line replaced, kept as the baseline of the parse benchmark
+static string get_legacy_fen(const string& line)
+{
+    int32_t space_count = 0;
+    size_t position = 0;
+    for (size_t index = 0; index < line.size(); index++)
+    {
+        if (line[index] == ' ')
+        {
+            space_count++;
+        }
+        if (space_count == 4)
+        {
+            position = index;
+            break;
+        }
+    }
+    return line.substr(0, position);
+}
+
+static double get_legacy_wdl(const string& line, const bool side_to_move_wdl)
+{
+    struct LegacyMarker
+    {
+        string marker;
+        double wdl;
+    };
+
+    static const array<LegacyMarker, 4> legacy_markers
+    {
+        LegacyMarker{"1.0", 1},
+        LegacyMarker{"1-0", 1},
+        LegacyMarker{"1/2-1/2", 0.5},
+        LegacyMarker{"0-1", 0}
+    };
+
+    double wdl = 0;
+    bool marker_found = false;
+    for (const auto& marker : legacy_markers)
+    {
+        if (line.find(marker.marker) != string::npos)
+        {
+            marker_found = true;
+            wdl = marker.wdl;
+        }
+    }
+
+    if (!marker_found)
+    {
+        stringstream stream(line);
+        while (!stream.eof())
+        {
+            string word;
+            stream >> word;
+            if (word.starts_with("0."))
+            {
+                wdl = stod(word);
+            }
+            else if (word.starts_with("[0."))
+            {
+                wdl = stod(word.substr(1, word.size() - 2));
+            }
+        }
+    }
+
+    const auto white_to_move = line.find('w') != string::npos;
+    return !white_to_move && side_to_move_wdl ? 1 - wdl : wdl;
+}
+
+enum class ParsePath
+{
+    Legacy,
+    SinglePass
+};
+
+struct ParseBenchResult
+{
+    string name;
+    double nanoseconds_per_line;
+    double allocations_per_line;
+};
+
+// Times parsing every line iterations times, with or without setting up a board from the FEN fields
+static ParseBenchResult run_parse_pass(const vector<string>& lines, const int32_t iterations, const ParsePath path, const bool setup_board, double& checksum)
+{
+    ParseBenchResult result;
+    result.name = string(path == ParsePath::Legacy ? "legacy" : "single_pass") + (setup_board ? "_board" : "_fields");
+    chess::Board board;
+    const auto allocations_start = allocation_count.load();
+    const auto start = high_resolution_clock::now();
+    for (int32_t iteration = 0; iteration < iterations; iteration++)
+    {
+        for (const auto& line : lines)
+        {
+            if (path == ParsePath::Legacy)
+            {
+                const auto fen = get_legacy_fen(line);
+                checksum += get_legacy_wdl(line, true) + fen.size();
+                if (setup_board)
+                {
+                    const chess::Board line_board(fen);
+                    checksum += line_board.occ().count();
+                }
+            }
+            else
+            {
+                const auto fen_line = parse_fen_line(line, true);
+                checksum += fen_line.wdl + fen_line.fen.size();
+                if (setup_board)
+                {
+                    board.setFen(fen_line.fen);
+                    checksum += board.occ().count();
+                }
+            }
+        }
+    }
+    const auto seconds = duration<double>(high_resolution_clock::now() - start).count();
+    const auto line_count = static_cast<double>(lines.size()) * iterations;
+    result.nanoseconds_per_line = seconds * 1e9 / line_count;
+    result.allocations_per_line = (allocation_count.load() - allocations_start) / line_count;
+    return result;
+}
+
+static int run_parse_bench(const vector<string>& args)
+{
+    string data_path;
+    int32_t iterations = 5;
+    bool json = false;
+    for (size_t arg_index = 0; arg_index < args.size(); arg_index++)
+    {
+        if (args[arg_index] == "--json")
+        {
+            json = true;
+        }
+        else if (args[arg_index] == "--iterations" && arg_index + 1 < args.size())
+        {
+            iterations = stoi(args[++arg_index]);
+        }
+        else if (data_path.empty() && !args[arg_index].starts_with("--"))
+        {
+            data_path = args[arg_index];
+        }
+        else
+        {
+            data_path.clear();
+            break;
+        }
+    }
+
+    if (data_path.empty())
+    {
+        cout << "Usage: tuner_bench parse <data.epd> [--iterations <count>] [--json]" << endl;
+        return -1;
+    }
+
+    ifstream file(data_path);
+    if (!file)
+    {
+        cout << "Failed to open " << data_path << endl;
+        return -1;
+    }
+
+    vector<string> lines;
+    string line;
+    while (getline(file, line))
+    {
+        if (!line.empty())
+        {
+            lines.push_back(line);
+        }
+    }
+
+    if (lines.empty())
+    {
+        cout << "No lines in " << data_path << endl;
+        return -1;
+    }
+
+    // Both paths have to agree before their timings mean anything
+    int64_t mismatch_count = 0;
+    for (const auto& data_line : lines)
+    {
+        const auto fen_line = parse_fen_line(data_line, true);
+        if (fen_line.fen != get_legacy_fen(data_line) || fen_line.wdl != get_legacy_wdl(data_line, true))
+        {
+            mismatch_count++;
+        }
+    }
+
+    double checksum = 0;
+    vector<ParseBenchResult> results;
+    for (const auto setup_board : { false, true })
+    {
+        results.push_back(run_parse_pass(lines, iterations, ParsePath::Legacy, setup_board, checksum));
+        results.push_back(run_parse_pass(lines, iterations, ParsePath::SinglePass, setup_board, checksum));
+    }
+
+    if (json)
+    {
+        cout << "{" << endl;
+        cout << "  \"lines\": " << lines.size() << "," << endl;
+        cout << "  \"iterations\": " << iterations << "," << endl;
+        cout << "  \"mismatches\": " << mismatch_count << "," << endl;
+        cout << "  \"results\": [";
+        for (size_t result_index = 0; result_index < results.size(); result_index++)
+        {
+            const auto& result = results[result_index];
+            cout << (result_index == 0 ? "" : ",") << endl;
+            cout << "    { \"path\": \"" << result.name << "\", \"nanoseconds_per_line\": " << result.nanoseconds_per_line;
+            cout << ", \"allocations_per_line\": " << result.allocations_per_line << " }";
+        }
+        cout << endl << "  ]" << endl << "}" << endl;
+    }
+    else
+    {
+        cout << lines.size() << " lines, " << mismatch_count << " with a different FEN or WDL between the paths" << endl;
+        for (const auto& result : results)
+        {
+            cout << result.name << ": " << result.nanoseconds_per_line << " ns/line, " << result.allocations_per_line << " allocations/line" << endl;
+        }
+    }
+
+    // Keeps the parsing from being optimized away
+    return checksum < 0 ? 1 : 0;
+}
+
+static int run_generate(const vector<string>& args)
+{
+    GeneratorOptions options;
+    for (size_t arg_index = 0; arg_index < args.size(); arg_index++)
+    {
+        if (args[arg_index] == "--games" && arg_index + 1 < args.size())
+        {
+            options.game_count = stoi(args[++arg_index]);
+        }
+        else if (args[arg_index] == "--seed" && arg_index + 1 < args.size())
+        {
+            options.seed = stoull(args[++arg_index]);
+        }
+        else if (args[arg_index] == "--mode" && arg_index + 1 < args.size() && (args[arg_index + 1] == "random" || args[arg_index + 1] == "greedy"))
+        {
+            options.mode = args[++arg_index] == "random" ? GeneratorMode::Random : GeneratorMode::Greedy;
+        }
+        else if (options.output_path.empty() && !args[arg_index].starts_with("--"))
+        {
+            options.output_path = args[arg_index];
+        }
+        else
+        {
+            options.output_path.clear();
+            break;
+        }
+    }
+
+    if (options.output_path.empty())
+    {
+        cout << "Usage: tuner_bench generate <output.epd|output.bin> [--games <count>] [--seed <seed>] [--mode random|greedy]" << endl;
+        return -1;
+    }
+
+    generate_dataset(options);
+    return 0;
+}
+
+static int run_tuning_bench(const vector<string>& args)
+{
+    string csv_path;
+    string engine_name;
+    TuningBenchOptions options;
+    bool json = false;
+    for (size_t arg_index = 0; arg_index < args.size(); arg_index++)
+    {
+        if (args[arg_index] == "--json")
+        {
+            json = true;
+        }
+        else if (args[arg_index] == "--engine" && arg_index + 1 < args.size())
+        {
+            engine_name = args[++arg_index];
+        }
+        else if (args[arg_index] == "--epochs" && arg_index + 1 < args.size())
+        {
+            options.epochs = stoi(args[++arg_index]);
+        }
+        else if (csv_path.empty() && !args[arg_index].starts_with("--"))
+        {
+            csv_path = args[arg_index];
+        }
+        else
+        {
+            csv_path.clear();
+            break;
+        }
+    }
+
+    if (csv_path.empty())
+    {
+        cout << "Usage: tuner_bench tuning <sources.csv> [--engine <name>] [--epochs <count>] [--json]" << endl;
+        return -1;
+    }
+
+    vector<DataSource> sources;
+    const auto sources_result = read_sources(csv_path, sources);
+    if (sources_result != 0)
+    {
+        return sources_result;
+    }
+
+    vector<pair<string, TuningBenchResult>> results;
+    for (const auto& engine : get_engines())
+    {
+        if (!engine_name.empty() && engine.name != engine_name)
+        {
+            continue;
+        }
+
+        // The tuner's loading progress would end up in the JSON document
+        if (json)
+        {
+            cout.setstate(ios::failbit);
+        }
+        results.emplace_back(engine.name, engine.bench_tuning(sources, options));
+        cout.clear();
+    }
+
+    if (results.empty())
+    {
+        cout << "Unknown engine " << engine_name << endl;
+        return -1;
+    }
+
+    if (json)
+    {
+        print_tuning_results_json(results, options.epochs);
+    }
+    else
+    {
+        print_tuning_results(results);
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    vector<string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "generate")
+    {
+        return run_generate(vector<string>(args.begin() + 1, args.end()));
+    }
+    if (!args.empty() && args[0] == "tuning")
+    {
+        return run_tuning_bench(vector<string>(args.begin() + 1, args.end()));
+    }
+    if (!args.empty() && args[0] == "parse")
+    {
+        return run_parse_bench(vector<string>(args.begin() + 1, args.end()));
+    }
+
+    string engine_name;
+    int32_t iterations = 10000;
+    bool json = false;
+    for (size_t arg_index = 0; arg_index < args.size(); arg_index++)
+    {
+        if (args[arg_index] == "--json")
+        {
+            json = true;
+        }
+        else if (args[arg_index] == "--engine" && arg_index + 1 < args.size())
+        {
+            engine_name = args[++arg_index];
+        }
+        else if (args[arg_index] == "--iterations" && arg_index + 1 < args.size())
+        {
+            iterations = stoi(args[++arg_index]);
+        }
+        else
+        {
+            cout << "Usage: tuner_bench [--engine <name>] [--iterations <count>] [--json]" << endl;
+            cout << "       tuner_bench generate <output.epd|output.bin> [--games <count>] [--seed <seed>] [--mode random|greedy]" << endl;
+            cout << "       tuner_bench tuning <sources.csv> [--engine <name>] [--epochs <count>] [--json]" << endl;
+            cout << "       tuner_bench parse <data.epd> [--iterations <count>] [--json]" << endl;
+            return -1;
+        }
+    }
+
+    vector<BenchResult> results;
+    for (const auto& engine : get_engines())
+    {
+        if (!engine_name.empty() && engine.name != engine_name)
+        {
+            continue;
+        }
+
+        results.push_back(run_bench(engine, iterations, TracePath::Fen));
+        results.push_back(run_bench(engine, iterations, TracePath::External));
+    }
+
+    if (results.empty())
+    {
+        cout << "Unknown engine " << engine_name << endl;
+        return -1;
+    }
+
+    if (json)
+    {
+        print_results_json(results, iterations);
+    }
+    else
+    {
+        print_results(results);
+    }
+
+    return 0;
+}
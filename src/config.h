@@ -3,20 +3,51 @@
 
 #include<cstdint>
 
-//#include "engines/toy.h"
-//#include "engines/toy_tapered.h"
-//#include "engines/fourku.h"
-//#include "engines/fourkdotcpp.h"
-#include "engines/tcheran.h"
+// The tuner is compiled once for every engine, which is then chosen on the command line.
+// TUNER_ENGINE_HEADER and TUNER_ENGINE_CLASS are set by add_tuner_engine in CMakeLists.txt.
+#include TUNER_ENGINE_HEADER
 
-//using TuneEval = Toy::ToyEval;
-//using TuneEval = Toy::ToyEvalTapered;
-/*using TuneEval = Fourkdotcpp::FourkdotcppEval;*/
-using TuneEval = Tcheran::TcheranEval;
+using TuneEval = TUNER_ENGINE_CLASS;
+
+enum class PositionSampling
+{
+    First,
+    Uniform,
+    PhaseStratified,
+    ResultStratified
+};
+
+constexpr int32_t data_read_thread_count = 2;
 constexpr int32_t data_load_thread_count = 4;
 constexpr int32_t thread_count = 12;
 constexpr static bool print_data_entries = false;
 constexpr static int32_t data_load_print_interval = 10000;
+constexpr static int32_t qsearch_refresh_interval = 0;
+constexpr static bool enable_qsearch_pruning = true;
+constexpr static int32_t pgn_min_ply = 16;
+constexpr static int32_t pgn_max_ply = 0;
+constexpr static int32_t pgn_sample_interval = 1;
+constexpr static bool pgn_skip_book = true;
+constexpr static bool pgn_skip_noisy = true;
+constexpr static PositionSampling position_sampling = PositionSampling::First;
+constexpr static uint64_t position_sampling_seed = 0;
+constexpr static double sampling_stratum_reserve = 1.0;
+constexpr static bool deduplicate_positions = false;
+constexpr static bool compact_coefficient_patterns = false;
+constexpr static bool stream_entries = false;
+constexpr static auto stream_directory = "entry_shards";
+constexpr static int64_t stream_shard_size = 256 << 20;
+constexpr static int32_t coordinate_block_size = 0;
+constexpr static bool cache_entry_evals = true;
+constexpr static auto frozen_parameters = "";
+constexpr static auto frozen_parameters_path = "";
+constexpr static int32_t eval_batch_size = 256;
+constexpr static bool enable_instrumentation = false;
+constexpr static auto instrumentation_path = "instrumentation.json";
+constexpr static int32_t instrumentation_export_interval = 100;
+constexpr static bool enable_trace_events = false;
+constexpr static auto trace_events_path = "trace_events.json";
+constexpr static int32_t trace_event_buffer_size = 1 << 16;
 
 
 #endif // !CONFIG_H
@@ -0,0 +1,150 @@
+#include "dataset_generator.h"
+#include "packed_board.h"
+#include "external/chess.hpp"
+
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+constexpr array<int32_t, 6> piece_values = { 100, 300, 300, 500, 900, 0 };
+constexpr int32_t adjudication_margin = 300;
+constexpr int32_t greedy_random_move_chance = 8;
+
+static int32_t get_material_balance(const chess::Board& board)
+{
+    int32_t balance = 0;
+    for (int32_t piece_type = 0; piece_type < static_cast<int32_t>(piece_values.size()); piece_type++)
+    {
+        const auto type = chess::PieceType(static_cast<chess::PieceType::underlying>(piece_type));
+        const auto white_count = static_cast<int32_t>(board.pieces(type, chess::Color::WHITE).count());
+        const auto black_count = static_cast<int32_t>(board.pieces(type, chess::Color::BLACK).count());
+        balance += piece_values[piece_type] * (white_count - black_count);
+    }
+    return balance;
+}
+
+static int32_t get_greedy_score(const chess::Board& board, const chess::Move move)
+{
+    int32_t score = 0;
+    if (move.typeOf() == chess::Move::ENPASSANT)
+    {
+        score += piece_values[0];
+    }
+    else if (move.typeOf() != chess::Move::CASTLING && board.at(move.to()) != chess::Piece::NONE)
+    {
+        score += piece_values[static_cast<int32_t>(board.at<chess::PieceType>(move.to()))];
+    }
+
+    if (move.typeOf() == chess::Move::PROMOTION)
+    {
+        score += piece_values[static_cast<int32_t>(move.promotionType())] - piece_values[0];
+    }
+    return score;
+}
+
+static chess::Move pick_move(const chess::Board& board, const chess::Movelist& moves, const GeneratorMode mode, mt19937_64& random)
+{
+    const auto random_index = [&](const size_t count) { return static_cast<size_t>(random() % count); };
+    if (mode == GeneratorMode::Random || random_index(greedy_random_move_chance) == 0)
+    {
+        return moves[random_index(moves.size())];
+    }
+
+    // Best capture, with ties broken randomly so that the games don't all repeat each other
+    int32_t best_score = -1;
+    vector<chess::Move> best_moves;
+    for (const auto& move : moves)
+    {
+        const auto score = get_greedy_score(board, move);
+        if (score > best_score)
+        {
+            best_score = score;
+            best_moves.clear();
+        }
+        if (score == best_score)
+        {
+            best_moves.push_back(move);
+        }
+    }
+    return best_moves[random_index(best_moves.size())];
+}
+
+// Plays one game, adds the positions from min_ply on to boards and returns the result for white
+static double play_game(const GeneratorOptions& options, mt19937_64& random, vector<chess::Board>& boards)
+{
+    chess::Board board;
+    chess::Movelist moves;
+    for (int32_t ply = 0; ply < options.max_ply; ply++)
+    {
+        const auto [reason, result] = board.isGameOver();
+        if (result != chess::GameResult::NONE)
+        {
+            if (result == chess::GameResult::LOSE)
+            {
+                return board.sideToMove() == chess::Color::WHITE ? 0 : 1;
+            }
+            return 0.5;
+        }
+
+        if (ply >= options.min_ply)
+        {
+            boards.push_back(board);
+        }
+
+        chess::movegen::legalmoves(moves, board);
+        board.makeMove(pick_move(board, moves, options.mode, random));
+    }
+
+    const auto balance = get_material_balance(board);
+    if (abs(balance) < adjudication_margin)
+    {
+        return 0.5;
+    }
+    return balance > 0 ? 1 : 0;
+}
+
+int64_t generate_dataset(const GeneratorOptions& options)
+{
+    const auto packed = options.output_path.ends_with(".bin");
+    ofstream output(options.output_path, packed ? ios::binary : ios::out);
+    if (!output)
+    {
+        cout << "Failed to open " << options.output_path << endl;
+        throw runtime_error("Failed to open generator output");
+    }
+
+    mt19937_64 random(options.seed);
+    vector<chess::Board> boards;
+    int64_t position_count = 0;
+    array<int64_t, 3> results{};
+    for (int32_t game_index = 0; game_index < options.game_count; game_index++)
+    {
+        boards.clear();
+        const auto result = play_game(options, random, boards);
+        results[static_cast<int32_t>(result * 2)]++;
+        for (const auto& board : boards)
+        {
+            if (packed)
+            {
+                auto packed_board = pack_board(board);
+                packed_board.result = static_cast<uint8_t>(lround(result * packed_result_scale));
+                output.write(reinterpret_cast<const char*>(&packed_board), sizeof(packed_board));
+            }
+            else
+            {
+                output << board.getFen() << " [" << (result == 1 ? "1.0" : (result == 0 ? "0.0" : "0.5")) << "]\n";
+            }
+        }
+        position_count += static_cast<int64_t>(boards.size());
+    }
+
+    cout << "Generated " << position_count << " positions from " << options.game_count << " games (";
+    cout << results[2] << " white wins, " << results[1] << " draws, " << results[0] << " black wins)" << endl;
+    return position_count;
+}
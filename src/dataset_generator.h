@@ -0,0 +1,31 @@
+#ifndef DATASET_GENERATOR_H
+#define DATASET_GENERATOR_H 1
+
+#include <cstdint>
+#include <string>
+
+enum class GeneratorMode
+{
+    // Uniformly random legal moves
+    Random,
+    // Captures the most valuable piece it can, with some random moves for variety
+    Greedy
+};
+
+struct GeneratorOptions
+{
+    // Files ending in .bin are written as packed positions, anything else as EPD
+    std::string output_path;
+    int32_t game_count = 1000;
+    uint64_t seed = 0;
+    GeneratorMode mode = GeneratorMode::Greedy;
+    // Positions before min_ply are not written, games still running at max_ply are adjudicated by material
+    int32_t min_ply = 8;
+    int32_t max_ply = 400;
+};
+
+// Plays seeded games with the move generator of chess.hpp and writes their positions, labelled with
+// the result of the game from white's point of view. Returns the number of positions written.
+int64_t generate_dataset(const GeneratorOptions& options);
+
+#endif // !DATASET_GENERATOR_H
@@ -0,0 +1,45 @@
+#include "tuner.h"
+
+using namespace std;
+using namespace Tuner;
+
+// Entry points of the tuner and benchmarks compiled for each engine by add_tuner_engine in CMakeLists.txt
+#define DECLARE_TUNER_ENGINE(engine) \
+    namespace Tuner::engine \
+    { \
+        void run(const vector<DataSource>& sources); \
+        void convert(const vector<DataSource>& sources, const string& output_path); \
+        TraceBenchResult bench_traces(const vector<string>& fens, int32_t iterations, TracePath path); \
+        TuningBenchResult bench_tuning(const vector<DataSource>& sources, const TuningBenchOptions& options); \
+    }
+
+DECLARE_TUNER_ENGINE(toy)
+DECLARE_TUNER_ENGINE(toy_tapered)
+DECLARE_TUNER_ENGINE(fourku)
+DECLARE_TUNER_ENGINE(fourkdotcpp)
+DECLARE_TUNER_ENGINE(tcheran)
+
+const vector<Engine>& Tuner::get_engines()
+{
+    static const vector<Engine> engines =
+    {
+        { "toy", toy::run, toy::convert, toy::bench_traces, toy::bench_tuning },
+        { "toy_tapered", toy_tapered::run, toy_tapered::convert, toy_tapered::bench_traces, toy_tapered::bench_tuning },
+        { "fourku", fourku::run, fourku::convert, fourku::bench_traces, fourku::bench_tuning },
+        { "fourkdotcpp", fourkdotcpp::run, fourkdotcpp::convert, fourkdotcpp::bench_traces, fourkdotcpp::bench_tuning },
+        { "tcheran", tcheran::run, tcheran::convert, tcheran::bench_traces, tcheran::bench_tuning },
+    };
+    return engines;
+}
+
+const Engine* Tuner::find_engine(const string& name)
+{
+    for (const auto& engine : get_engines())
+    {
+        if (engine.name == name)
+        {
+            return &engine;
+        }
+    }
+    return nullptr;
+}
@@ -11,6 +11,13 @@
 using namespace std;
 using namespace Fourkdotcpp;
 
+using parameters_t = FourkdotcppEval::parameters_t;
+
+static constexpr int32_t S(const int32_t mg, const int32_t eg)
+{
+    return averaged_score(mg, eg);
+}
+
 using u64 = uint64_t;
 using i32 = int;
 
@@ -27,6 +34,8 @@ enum
 
 static std::string pc_to_str[] = {"Pawn", "Knight", "Bishop", "Rook", "Queen", "King", "None"};
 
+namespace
+{
 struct [[nodiscard]] Position {
     array<int, 4> castling = { true, true, true, true };
     array<u64, 2> colour = { 0xFFFFULL, 0xFFFF000000000000ULL };
@@ -41,58 +50,23 @@ struct [[nodiscard]] Position {
 
     auto operator<=>(const Position&) const = default;
 };
+}
 
 [[nodiscard]] static u64 flip(u64 bb) {
-    u64 result;
-    char* bb_ptr = reinterpret_cast<char*>(&bb);
-    char* result_ptr = reinterpret_cast<char*>(&result);
-    for (int i = 0; i < sizeof(bb); i++)
-    {
-        result_ptr[i] = bb_ptr[sizeof(bb) - 1 - i];
-    }
-    return result;
+#ifdef __cpp_lib_byteswap
+    return byteswap(bb);
+#else
+    // Compilers turn this into a single byte swap instruction
+    bb = ((bb >> 8) & 0x00FF00FF00FF00FFULL) | ((bb & 0x00FF00FF00FF00FFULL) << 8);
+    bb = ((bb >> 16) & 0x0000FFFF0000FFFFULL) | ((bb & 0x0000FFFF0000FFFFULL) << 16);
+    return (bb >> 32) | (bb << 32);
+#endif
 }
 
 [[nodiscard]] static auto lsb(const u64 bb) {
     return countr_zero(bb);
 }
 
-[[nodiscard]] static auto count(const u64 bb) {
-    return popcount(bb);
-}
-
-[[nodiscard]] static auto east(const u64 bb) {
-    return (bb << 1) & ~0x0101010101010101ULL;
-}
-
-[[nodiscard]] static auto west(const u64 bb) {
-    return (bb >> 1) & ~0x8080808080808080ULL;
-}
-
-[[nodiscard]] static u64 north(const u64 bb) {
-    return bb << 8;
-}
-
-[[nodiscard]] static u64 south(const u64 bb) {
-    return bb >> 8;
-}
-
-[[nodiscard]] static u64 nw(const u64 bb) {
-    return north(west(bb));
-}
-
-[[nodiscard]] static u64 ne(const u64 bb) {
-    return north(east(bb));
-}
-
-[[nodiscard]] static u64 sw(const u64 bb) {
-    return south(west(bb));
-}
-
-[[nodiscard]] static u64 se(const u64 bb) {
-    return south(east(bb));
-}
-
 static void flip(Position& pos) {
     pos.colour[0] = flip(pos.colour[0]);
     pos.colour[1] = flip(pos.colour[1]);
@@ -106,38 +80,6 @@ static void flip(Position& pos) {
     pos.flipped = !pos.flipped;
 }
 
-template <typename F>
-[[nodiscard]] auto ray(const int sq, const u64 blockers, F f) {
-    u64 mask = f(1ULL << sq);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    return mask;
-}
-
-[[nodiscard]] u64 knight(const int sq, const u64) {
-    const u64 bb = 1ULL << sq;
-    return (((bb << 15) | (bb >> 17)) & 0x7F7F7F7F7F7F7F7FULL) | (((bb << 17) | (bb >> 15)) & 0xFEFEFEFEFEFEFEFEULL) |
-        (((bb << 10) | (bb >> 6)) & 0xFCFCFCFCFCFCFCFCULL) | (((bb << 6) | (bb >> 10)) & 0x3F3F3F3F3F3F3F3FULL);
-}
-
-[[nodiscard]] static auto bishop(const int sq, const u64 blockers) {
-    return ray(sq, blockers, nw) | ray(sq, blockers, ne) | ray(sq, blockers, sw) | ray(sq, blockers, se);
-}
-
-[[nodiscard]] static auto rook(const int sq, const u64 blockers) {
-    return ray(sq, blockers, north) | ray(sq, blockers, east) | ray(sq, blockers, south) | ray(sq, blockers, west);
-}
-
-[[nodiscard]] static u64 king(const int sq, const u64) {
-    const u64 bb = 1ULL << sq;
-    return (bb << 8) | (bb >> 8) | (((bb >> 1) | (bb >> 9) | (bb << 7)) & 0x7F7F7F7F7F7F7F7FULL) |
-        (((bb << 1) | (bb << 9) | (bb >> 7)) & 0xFEFEFEFEFEFEFEFEULL);
-}
-
 static void set_fen(Position& pos, const string& fen) {
     // Clear
     pos.colour = {};
@@ -196,16 +138,6 @@ static void set_fen(Position& pos, const string& fen) {
     }
 }
 
-struct Trace
-{
-    int score;
-    tune_t endgame_scale;
-
-    int material[6][2]{};
-    int pst_rank[48][2]{};
-    int pst_file[48][2]{};
-};
-
 const i32 phases[] = {0, 1, 1, 2, 4, 0};
 const i32 max_material[] = {147, 521, 521, 956, 1782, 0, 0};
 const i32 material[] = {S(89, 147), S(350, 521), S(361, 521), S(479, 956), S(1046, 1782), 0};
@@ -226,9 +158,30 @@ const i32 pst_file[] = {
     S(-2, -5), S(2, -1),  S(-1, 1), S(-4, 2), S(-4, 2), S(-2, 2), S(2, -1), S(0, -5),   // King
 };
 
+constexpr auto layout = make_parameter_layout(
+    ParameterTerm{ "material", TermShape::Array, 6, 1, "", material },
+    ParameterTerm{ "pst_rank", TermShape::Array2d, 6, 8, "", pst_rank },
+    ParameterTerm{ "pst_file", TermShape::Array2d, 6, 8, "", pst_file }
+);
+static_assert(layout.parameter_count() == FourkdotcppEval::parameter_count, "Parameter layout doesn't match parameter_count");
 
-#define TraceIncr(parameter) trace.parameter[color]++
-#define TraceAdd(parameter, count) trace.parameter[color] += count
+constexpr auto material_term = layout.term("material");
+constexpr auto pst_rank_term = layout.term("pst_rank");
+constexpr auto pst_file_term = layout.term("pst_file");
+
+namespace
+{
+struct Trace
+{
+    int score;
+    tune_t endgame_scale;
+
+    ParameterTrace<layout.parameter_count()> terms{};
+};
+}
+
+#define TraceIncr(parameter) trace.terms[parameter][color]++
+#define TraceAdd(parameter, count) trace.terms[parameter][color] += count
 
 static Trace eval(Position& pos) {
     Trace trace{};
@@ -248,17 +201,17 @@ static Trace eval(Position& pos) {
                 // Material
                 phase += phases[p];
                 score += material[p];
-                TraceIncr(material[p]);
+                TraceIncr(material_term(p));
 
                 const int rank = sq / 8;
                 const int file = sq % 8;
 
                 // Split quantized PSTs
                 score += pst_rank[p * 8 + rank] * 1;
-                TraceAdd(pst_rank[p * 8 + rank], 1);
+                TraceAdd(pst_rank_term(p, rank), 1);
 
                 score += pst_file[p * 8 + file] * 1;
-                TraceAdd(pst_file[p * 8 + file], 1);
+                TraceAdd(pst_file_term(p, file), 1);
             }
         }
 
@@ -267,21 +220,8 @@ static Trace eval(Position& pos) {
         score = -score;
     }
 
-#if TAPERED
-    // Tapered eval with endgame scaling based on remaining pawn count of the stronger side
-    int stronger_colour = score < 0;
-    auto stronger_colour_pieces = pos.colour[stronger_colour];
-    auto stronger_colour_pawns = stronger_colour_pieces & pos.pieces[Pawn];
-    auto stronger_colour_pawn_count = count(stronger_colour_pawns);
-    auto stronger_colour_pawns_missing = 8 - stronger_colour_pawn_count;
-    auto scale = (128 - stronger_colour_pawns_missing * stronger_colour_pawns_missing) / static_cast<tune_t>(128);
-        
-    trace.endgame_scale = scale;
-    trace.score = ((short)score * phase + ((score + 0x8000) >> 16) * scale * (24 - phase)) / 24;
-#else
     trace.endgame_scale = 1;
     trace.score = score;
-#endif
 
     if (pos.flipped)
     {
@@ -295,36 +235,10 @@ static int32_t round_value(tune_t value)
     return static_cast<int32_t>(round(value));
 }
 
-#if TAPERED
-
-static void print_parameter(std::stringstream& ss, const pair_t parameter)
-{
-    const auto mg = round_value(parameter[static_cast<int32_t>(PhaseStages::Midgame)]);
-    const auto eg = round_value(parameter[static_cast<int32_t>(PhaseStages::Endgame)]);
-    if (mg == 0 && eg == 0)
-    {
-        ss << 0;
-    }
-    else
-    {
-        ss << "S(" << mg << ", " << eg << ")";
-    }
-}
-#else
 static void print_parameter(std::stringstream& ss, const tune_t parameter)
 {
     ss << round_value(std::round(parameter));
 }
-#endif
-
-static void print_single(std::stringstream& ss, const parameters_t& parameters, int& index, const std::string& name)
-{
-    ss << "const i32 " << name << " = ";
-    print_parameter(ss, parameters[index]);
-    index++;
-
-    ss << ";" << endl;
-}
 
 static void print_array(std::stringstream& ss, const parameters_t& parameters, int& index, const std::string& name, const int count)
 {
@@ -360,41 +274,13 @@ static void print_pst(std::stringstream& ss, const parameters_t& parameters, int
     ss << "};" << endl;
 }
 
-static void print_array_2d(std::stringstream& ss, const parameters_t& parameters, int& index, const std::string& name, const int count1, const int count2)
-{
-    ss << "const i32 " << name << "[][" << count2 << "] = {\n";
-    for (auto i = 0; i < count1; i++)
-    {
-        ss << "    {";
-        for (auto j = 0; j < count2; j++)
-        {
-            print_parameter(ss, parameters[index]);
-            index++;
-
-            if (j != count2 - 1)
-            {
-                ss << ", ";
-            }
-        }
-        ss << "},\n";
-    }
-    ss << "};\n";
-}
-
 static void print_max_material(std::stringstream& ss, const parameters_t& parameters)
 {
     ss << "const i32 max_material[] = {";
     for (auto i = 0; i < 6; i++)
     {
-#if TAPERED
-        const auto mg = parameters[i][static_cast<int>(PhaseStages::Midgame)];
-        const auto eg = parameters[i][static_cast<int>(PhaseStages::Endgame)];
-        const auto max_material = round_value(max(mg, eg));
-        ss << max_material << ", ";
-#else
-        const auto score = round_value(parameters[i]);
+        const auto score = round_value(parameters[material_term(i)]);
         ss << score << ", ";
-#endif
     }
     ss << "0};" << endl;
 }
@@ -404,81 +290,72 @@ static void rebalance_psts(parameters_t& parameters, const int32_t pst_offset, b
     for (auto pieceIndex = 0; pieceIndex < 5; pieceIndex++)
     {
         const int pstStart = pst_offset + pieceIndex * pst_size;
-#if TAPERED
-        for (int stage = 0; stage < 2; stage++)
+        double sum = 0;
+        for (auto i = 0; i < pst_size; i++)
         {
-#endif
-            double sum = 0;
-            for (auto i = 0; i < pst_size; i++)
+            if (pieceIndex == 0 && pawn_exclusion && (i == 0 || i == pst_size - 1 || i == pst_size - 2))
             {
-                if (pieceIndex == 0 && pawn_exclusion && (i == 0 || i == pst_size - 1 || i == pst_size - 2))
-                {
-                    continue;
-                }
-                const auto pstIndex = pstStart + i;
-#if TAPERED
-                sum += parameters[pstIndex][stage];
-#else
-                sum += parameters[pstIndex];
-#endif
+                continue;
             }
+            const auto pstIndex = pstStart + i;
+            sum += parameters[pstIndex];
+        }
 
-            const auto average = sum / (pieceIndex == 0 && pawn_exclusion ? pst_size - 3 : pst_size);
-            //const auto average = sum / pst_size;
-#if TAPERED
-            parameters[pieceIndex][stage] += average * quantization;
-#else
-            parameters[pieceIndex] += average * quantization;
-#endif
-            for (auto i = 0; i < pst_size; i++)
+        const auto average = sum / (pieceIndex == 0 && pawn_exclusion ? pst_size - 3 : pst_size);
+        //const auto average = sum / pst_size;
+        parameters[material_term(pieceIndex)] += average * quantization;
+        for (auto i = 0; i < pst_size; i++)
+        {
+            if (pieceIndex == 0 && pawn_exclusion && (i == 0 || i == pst_size - 1 || i == pst_size - 2))
             {
-                if (pieceIndex == 0 && pawn_exclusion && (i == 0 || i == pst_size - 1 || i == pst_size - 2))
-                {
-                    continue;
-                }
-                const auto pstIndex = pstStart + i;
-#if TAPERED
-                parameters[pstIndex][stage] -= average;
-#else
-                parameters[pstIndex] -= average;
-#endif
+                continue;
             }
-#if TAPERED
+            const auto pstIndex = pstStart + i;
+            parameters[pstIndex] -= average;
         }
-#endif
     }
 }
 
 parameters_t FourkdotcppEval::get_initial_parameters()
 {
-    parameters_t parameters;
-    get_initial_parameter_array(parameters, material, 6);
-    get_initial_parameter_array(parameters, pst_rank, 48);
-    get_initial_parameter_array(parameters, pst_file, 48);
-    return parameters;
+    return layout.get_initial_parameters<phase_model_t>();
 }
 
 static coefficients_t get_coefficients(const Trace& trace)
 {
     coefficients_t coefficients;
-    get_coefficient_array(coefficients, trace.material, 6);
-    get_coefficient_array(coefficients, trace.pst_rank, 48);
-    get_coefficient_array(coefficients, trace.pst_file, 48);
+    get_trace_coefficients(coefficients, trace.terms);
     return coefficients;
 }
 
+std::vector<ParameterRange> FourkdotcppEval::get_parameter_ranges()
+{
+    return layout.get_ranges();
+}
+
 void FourkdotcppEval::print_parameters(const parameters_t& parameters)
 {
     parameters_t parameters_copy = parameters;
-    rebalance_psts(parameters_copy, 6, true, 8, 1);
-    rebalance_psts(parameters_copy, 6 + 6 * 8, false, 8, 1);
+    rebalance_psts(parameters_copy, pst_rank_term(), true, 8, 1);
+    rebalance_psts(parameters_copy, pst_file_term(), false, 8, 1);
 
-    int index = 0;
     stringstream ss;
     print_max_material(ss, parameters_copy);
-    print_array(ss, parameters_copy, index, "material", 6);
-    print_pst(ss, parameters_copy, index, "pst_rank");
-    print_pst(ss, parameters_copy, index, "pst_file");
+    layout.print([&](const ParameterTerm& term, int& index)
+    {
+        const auto name = string(term.name);
+        switch (term.shape)
+        {
+        case TermShape::Array:
+            print_array(ss, parameters_copy, index, name, term.size());
+            break;
+        case TermShape::Array2d:
+            print_pst(ss, parameters_copy, index, name);
+            break;
+        default:
+            throw logic_error("Unsupported parameter term shape");
+        }
+    });
     cout << ss.str() << "\n";
 }
 
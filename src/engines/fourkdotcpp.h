@@ -1,8 +1,6 @@
 #ifndef FOURKU_H
 #define FOURKU_H 1
 
-#define TAPERED 0 
-
 #include "../base.h"
 #include "../external/chess.hpp"
 
@@ -14,6 +12,10 @@ namespace Fourkdotcpp
     class FourkdotcppEval
     {
     public:
+        using phase_model_t = UntaperedPhase;
+        using parameters_t = Parameters<phase_model_t>;
+
+        constexpr static int32_t parameter_count = 102;
         constexpr static bool includes_additional_score = true;
         constexpr static bool supports_external_chess_eval = true;
         constexpr static bool retune_from_zero = true;
@@ -28,6 +30,7 @@ namespace Fourkdotcpp
         constexpr static int32_t data_load_print_interval = 10000;
 
         static parameters_t get_initial_parameters();
+        static std::vector<ParameterRange> get_parameter_ranges();
         static EvalResult get_fen_eval_result(const std::string& fen);
         static EvalResult get_external_eval_result(const chess::Board& board);
         static void print_parameters(const parameters_t& parameters);
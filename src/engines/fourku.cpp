@@ -11,6 +11,13 @@
 using namespace std;
 using namespace Fourku;
 
+using parameters_t = FourkuEval::parameters_t;
+
+static constexpr int32_t S(const int32_t mg, const int32_t eg)
+{
+    return packed_score(mg, eg);
+}
+
 using u64 = uint64_t;
 using i32 = int;
 
@@ -27,6 +34,8 @@ enum
 
 static std::string pc_to_str[] = {"Pawn", "Knight", "Bishop", "Rook", "Queen", "King", "None"};
 
+namespace
+{
 struct [[nodiscard]] Position {
     array<int, 4> castling = { true, true, true, true };
     array<u64, 2> colour = { 0xFFFFULL, 0xFFFF000000000000ULL };
@@ -41,16 +50,17 @@ struct [[nodiscard]] Position {
 
     auto operator<=>(const Position&) const = default;
 };
+}
 
 [[nodiscard]] static u64 flip(u64 bb) {
-    u64 result;
-    char* bb_ptr = reinterpret_cast<char*>(&bb);
-    char* result_ptr = reinterpret_cast<char*>(&result);
-    for (int i = 0; i < sizeof(bb); i++)
-    {
-        result_ptr[i] = bb_ptr[sizeof(bb) - 1 - i];
-    }
-    return result;
+#ifdef __cpp_lib_byteswap
+    return byteswap(bb);
+#else
+    // Compilers turn this into a single byte swap instruction
+    bb = ((bb >> 8) & 0x00FF00FF00FF00FFULL) | ((bb & 0x00FF00FF00FF00FFULL) << 8);
+    bb = ((bb >> 16) & 0x0000FFFF0000FFFFULL) | ((bb & 0x0000FFFF0000FFFFULL) << 16);
+    return (bb >> 32) | (bb << 32);
+#endif
 }
 
 [[nodiscard]] static auto lsb(const u64 bb) {
@@ -106,36 +116,21 @@ static void flip(Position& pos) {
     pos.flipped = !pos.flipped;
 }
 
-template <typename F>
-[[nodiscard]] auto ray(const int sq, const u64 blockers, F f) {
-    u64 mask = f(1ULL << sq);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    mask |= f(mask & ~blockers);
-    return mask;
-}
-
+// Attack tables of chess.hpp, which are initialized when the program starts
 [[nodiscard]] static u64 knight(const int sq, const u64) {
-    const u64 bb = 1ULL << sq;
-    return (((bb << 15) | (bb >> 17)) & 0x7F7F7F7F7F7F7F7FULL) | (((bb << 17) | (bb >> 15)) & 0xFEFEFEFEFEFEFEFEULL) |
-        (((bb << 10) | (bb >> 6)) & 0xFCFCFCFCFCFCFCFCULL) | (((bb << 6) | (bb >> 10)) & 0x3F3F3F3F3F3F3F3FULL);
+    return chess::attacks::knight(chess::Square(sq)).getBits();
 }
 
-[[nodiscard]] static auto bishop(const int sq, const u64 blockers) {
-    return ray(sq, blockers, nw) | ray(sq, blockers, ne) | ray(sq, blockers, sw) | ray(sq, blockers, se);
+[[nodiscard]] static u64 bishop(const int sq, const u64 blockers) {
+    return chess::attacks::bishop(chess::Square(sq), chess::Bitboard(blockers)).getBits();
 }
 
-[[nodiscard]] static auto rook(const int sq, const u64 blockers) {
-    return ray(sq, blockers, north) | ray(sq, blockers, east) | ray(sq, blockers, south) | ray(sq, blockers, west);
+[[nodiscard]] static u64 rook(const int sq, const u64 blockers) {
+    return chess::attacks::rook(chess::Square(sq), chess::Bitboard(blockers)).getBits();
 }
 
 [[nodiscard]] static u64 king(const int sq, const u64) {
-    const u64 bb = 1ULL << sq;
-    return (bb << 8) | (bb >> 8) | (((bb >> 1) | (bb >> 9) | (bb << 7)) & 0x7F7F7F7F7F7F7F7FULL) |
-        (((bb << 1) | (bb << 9) | (bb >> 7)) & 0xFEFEFEFEFEFEFEFEULL);
+    return chess::attacks::king(chess::Square(sq)).getBits();
 }
 
 static void set_fen(Position& pos, const string& fen) {
@@ -196,29 +191,6 @@ static void set_fen(Position& pos, const string& fen) {
     }
 }
 
-struct Trace
-{
-    int score;
-    tune_t endgame_scale;
-
-    int material[6][2]{};
-    int pst_rank[48][2]{};
-    int pst_file[48][2]{};
-    int open_files[10][2]{};
-    int mobilities[5][2]{};
-    int king_attacks[5][2]{};
-    int pawn_protection[6][2]{};
-    int pawn_threat_penalty[6][2]{};
-    int passers[4][2]{};
-    int pawn_doubled_penalty[2]{};
-    int pawn_phalanx[2]{};
-    int pawn_passed_protected[2]{};
-    int pawn_passed_blocked_penalty[4][2]{};
-    int pawn_passed_king_distance[2][2]{};
-    int bishop_pair[2]{};
-    int king_shield[2][2]{};
-};
-
 const i32 phases[] = {0, 1, 1, 2, 4, 0};
 const i32 max_material[] = {147, 521, 521, 956, 1782, 0, 0};
 const i32 material[] = {S(89, 147), S(350, 521), S(361, 521), S(479, 956), S(1046, 1782), 0};
@@ -266,8 +238,56 @@ const i32 bishop_pair = S(29, 84);
 const i32 king_shield[] = {S(33, -10), S(25, -7)};
 const i32 pawn_attacked_penalty[] = {S(63, 14), S(156, 140)};
 
-#define TraceIncr(parameter) trace.parameter[color]++
-#define TraceAdd(parameter, count) trace.parameter[color] += count
+constexpr auto layout = make_parameter_layout(
+    ParameterTerm{ "material", TermShape::Array, 6, 1, "", material },
+    ParameterTerm{ "pst_rank", TermShape::Array2d, 6, 8, "", pst_rank },
+    ParameterTerm{ "pst_file", TermShape::Array2d, 6, 8, "", pst_file },
+    ParameterTerm{ "open_files", TermShape::Array, 10, 1, "", open_files },
+    ParameterTerm{ "mobilities", TermShape::Array, 5, 1, "", mobilities },
+    ParameterTerm{ "king_attacks", TermShape::Array, 5, 1, "", king_attacks },
+    ParameterTerm{ "pawn_protection", TermShape::Array, 6, 1, "", pawn_protection },
+    ParameterTerm{ "pawn_threat_penalty", TermShape::Array, 6, 1, "", pawn_threat_penalty },
+    ParameterTerm{ "passers", TermShape::Array, 4, 1, "", passers },
+    ParameterTerm{ "pawn_passed_protected", TermShape::Single, 1, 1, "", &pawn_passed_protected },
+    ParameterTerm{ "pawn_doubled_penalty", TermShape::Single, 1, 1, "", &pawn_doubled_penalty },
+    ParameterTerm{ "pawn_phalanx", TermShape::Single, 1, 1, "", &pawn_phalanx },
+    ParameterTerm{ "pawn_passed_blocked_penalty", TermShape::Array, 4, 1, "", pawn_passed_blocked_penalty },
+    ParameterTerm{ "pawn_passed_king_distance", TermShape::Array, 2, 1, "", pawn_passed_king_distance },
+    ParameterTerm{ "bishop_pair", TermShape::Single, 1, 1, "", &bishop_pair },
+    ParameterTerm{ "king_shield", TermShape::Array, 2, 1, "", king_shield }
+);
+static_assert(layout.parameter_count() == FourkuEval::parameter_count, "Parameter layout doesn't match parameter_count");
+
+constexpr auto material_term = layout.term("material");
+constexpr auto pst_rank_term = layout.term("pst_rank");
+constexpr auto pst_file_term = layout.term("pst_file");
+constexpr auto open_files_term = layout.term("open_files");
+constexpr auto mobilities_term = layout.term("mobilities");
+constexpr auto king_attacks_term = layout.term("king_attacks");
+constexpr auto pawn_protection_term = layout.term("pawn_protection");
+constexpr auto pawn_threat_penalty_term = layout.term("pawn_threat_penalty");
+constexpr auto passers_term = layout.term("passers");
+constexpr auto pawn_passed_protected_term = layout.term("pawn_passed_protected");
+constexpr auto pawn_doubled_penalty_term = layout.term("pawn_doubled_penalty");
+constexpr auto pawn_phalanx_term = layout.term("pawn_phalanx");
+constexpr auto pawn_passed_blocked_penalty_term = layout.term("pawn_passed_blocked_penalty");
+constexpr auto pawn_passed_king_distance_term = layout.term("pawn_passed_king_distance");
+constexpr auto bishop_pair_term = layout.term("bishop_pair");
+constexpr auto king_shield_term = layout.term("king_shield");
+
+namespace
+{
+struct Trace
+{
+    int score;
+    tune_t endgame_scale;
+
+    ParameterTrace<layout.parameter_count()> terms{};
+};
+}
+
+#define TraceIncr(parameter) trace.terms[parameter][color]++
+#define TraceAdd(parameter, count) trace.terms[parameter][color] += count
 
 static Trace eval(Position& pos) {
     Trace trace{};
@@ -287,16 +307,16 @@ static Trace eval(Position& pos) {
         // Bishop pair
         if (count(pos.colour[0] & pos.pieces[Bishop]) == 2) {
             score += bishop_pair;
-            TraceIncr(bishop_pair);
+            TraceIncr(bishop_pair_term());
         }
 
         // Doubled pawns
         score -= pawn_doubled_penalty * count((north(pawns[0]) | north(north(pawns[0]))) & pawns[0]);
-        TraceAdd(pawn_doubled_penalty, -count((north(pawns[0]) | north(north(pawns[0]))) & pawns[0]));
+        TraceAdd(pawn_doubled_penalty_term(), -count((north(pawns[0]) | north(north(pawns[0]))) & pawns[0]));
 
         // Phalanx pawns
         score += pawn_phalanx * count(west(pawns[0]) & pawns[0]);
-        TraceAdd(pawn_phalanx, count(west(pawns[0]) & pawns[0]));
+        TraceAdd(pawn_phalanx_term(), count(west(pawns[0]) & pawns[0]));
 
         // For each piece type
         for (int p = 0; p < 6; ++p) {
@@ -308,7 +328,7 @@ static Trace eval(Position& pos) {
                 // Material
                 phase += phases[p];
                 score += material[p];
-                TraceIncr(material[p]);
+                TraceIncr(material_term(p));
 
                 const int rank = sq / 8;
                 const int file = sq % 8;
@@ -317,47 +337,47 @@ static Trace eval(Position& pos) {
                 if (p != Pawn || (rank != 0 && rank != 6 && rank != 7)) // Special for tuner. Rank 6 = guaranteed passer
                 {
                     score += pst_rank[p * 8 + rank] * 8;
-                    TraceAdd(pst_rank[p * 8 + rank], 8);
+                    TraceAdd(pst_rank_term(p, rank), 8);
                 }
                 score += pst_file[p * 8 + file] * 8;
-                TraceAdd(pst_file[p * 8 + file], 8);
+                TraceAdd(pst_file_term(p, file), 8);
 
                 // Pawn protection
                 const u64 piece_bb = 1ULL << sq;
                 if (piece_bb & protected_by_pawns) {
                     score += pawn_protection[p];
-                    TraceIncr(pawn_protection[p]);
+                    TraceIncr(pawn_protection_term(p));
                 }
 
                 // Pawn threat
                 if (0x101010101010101ULL << sq & ~piece_bb & attacked_by_pawns)
                 {
                     score -= pawn_threat_penalty[p];
-                    TraceAdd(pawn_threat_penalty[p], -1);
+                    TraceAdd(pawn_threat_penalty_term(p), -1);
                 }
 
                 if (p == Pawn) {
                     // Passed pawns
                     if (rank > 2 && !(0x101010101010101ULL << sq & (pawns[1] | attacked_by_pawns))) {
                         score += passers[rank - 3];
-                        TraceIncr(passers[rank - 3]);
+                        TraceIncr(passers_term(rank - 3));
 
                         if (piece_bb & protected_by_pawns) {
                             score += pawn_passed_protected;
-                            TraceIncr(pawn_passed_protected);
+                            TraceIncr(pawn_passed_protected_term());
                         }
 
                         // Blocked passed pawns
                         if (north(piece_bb) & pos.colour[1]) {
                             score -= pawn_passed_blocked_penalty[rank - 3];
-                            TraceAdd(pawn_passed_blocked_penalty[rank - 3], -1);
+                            TraceAdd(pawn_passed_blocked_penalty_term(rank - 3), -1);
                         }
 
                         // King defense/attack
                         // king distance to square in front of passer
                         for (int i = 0; i < 2; ++i) {
                             score += pawn_passed_king_distance[i] * (rank - 1) * max(abs((kings[i] / 8) - (rank + 1)), abs((kings[i] % 8) - file));
-                            TraceAdd(pawn_passed_king_distance[i], (rank - 1) * max(abs((kings[i] / 8) - (rank + 1)), abs((kings[i] % 8) - file)));
+                            TraceAdd(pawn_passed_king_distance_term(i), (rank - 1) * max(abs((kings[i] / 8) - (rank + 1)), abs((kings[i] % 8) - file)));
                         }
                     }
                 }
@@ -373,7 +393,7 @@ static Trace eval(Position& pos) {
                     const u64 file_bb = 0x101010101010101ULL << file;
                     if (!(file_bb & pawns[0])) {
                         score += open_files[!(file_bb & pawns[1]) * 5 + p - 1];
-                        TraceIncr(open_files[!(file_bb & pawns[1]) * 5 + p - 1]);
+                        TraceIncr(open_files_term(!(file_bb & pawns[1]) * 5 + p - 1));
                     }
 
                     u64 mobility = 0;
@@ -392,13 +412,13 @@ static Trace eval(Position& pos) {
                     }
                     //mobility &= ~pos.colour[0] & ~attacked_by_pawns;
                     score += mobilities[p - 1] * count(mobility & ~pos.colour[0] & ~attacked_by_pawns);
-                    TraceAdd(mobilities[p - 1], count(mobility & ~pos.colour[0] & ~attacked_by_pawns));
+                    TraceAdd(mobilities_term(p - 1), count(mobility & ~pos.colour[0] & ~attacked_by_pawns));
 
                     // Attacks on opponent king
                     if (p != King)
                     {
                         score += king_attacks[p - 1] * count(mobility & king(kings[1], 0));
-                        TraceAdd(king_attacks[p - 1], count(mobility & king(kings[1], 0)));
+                        TraceAdd(king_attacks_term(p - 1), count(mobility & king(kings[1], 0)));
                     }
 
                     if (p == King && piece_bb & 0xC3D7) {
@@ -407,10 +427,10 @@ static Trace eval(Position& pos) {
                         // walk around with the king.
                         const u64 shield = file < 3 ? 0x700 : 0xE000;
                         score += count(shield & pawns[0]) * king_shield[0];
-                        TraceAdd(king_shield[0], count(shield & pawns[0]));
+                        TraceAdd(king_shield_term(0), count(shield & pawns[0]));
 
                         score += count(north(shield) & pawns[0]) * king_shield[1];
-                        TraceAdd(king_shield[1], count(north(shield) & pawns[0]));
+                        TraceAdd(king_shield_term(1), count(north(shield) & pawns[0]));
                     }
                 }
             }
@@ -421,7 +441,6 @@ static Trace eval(Position& pos) {
         score = -score;
     }
 
-#if TAPERED
     // Tapered eval with endgame scaling based on remaining pawn count of the stronger side
     int stronger_colour = score < 0;
     auto stronger_colour_pieces = pos.colour[stronger_colour];
@@ -432,10 +451,6 @@ static Trace eval(Position& pos) {
         
     trace.endgame_scale = scale;
     trace.score = ((short)score * phase + ((score + 0x8000) >> 16) * scale * (24 - phase)) / 24;
-#else
-    trace.endgame_scale = 1;
-    trace.score = score;
-#endif
 
     if (pos.flipped)
     {
@@ -449,8 +464,6 @@ static int32_t round_value(tune_t value)
     return static_cast<int32_t>(round(value));
 }
 
-#if TAPERED
-
 static void print_parameter(std::stringstream& ss, const pair_t parameter)
 {
     const auto mg = round_value(parameter[static_cast<int32_t>(PhaseStages::Midgame)]);
@@ -464,12 +477,6 @@ static void print_parameter(std::stringstream& ss, const pair_t parameter)
         ss << "S(" << mg << ", " << eg << ")";
     }
 }
-#else
-static void print_parameter(std::stringstream& ss, const tune_t parameter)
-{
-    ss << round_value(std::round(parameter));
-}
-#endif
 
 static void print_single(std::stringstream& ss, const parameters_t& parameters, int& index, const std::string& name)
 {
@@ -514,41 +521,15 @@ static void print_pst(std::stringstream& ss, const parameters_t& parameters, int
     ss << "};" << endl;
 }
 
-static void print_array_2d(std::stringstream& ss, const parameters_t& parameters, int& index, const std::string& name, const int count1, const int count2)
-{
-    ss << "const i32 " << name << "[][" << count2 << "] = {\n";
-    for (auto i = 0; i < count1; i++)
-    {
-        ss << "    {";
-        for (auto j = 0; j < count2; j++)
-        {
-            print_parameter(ss, parameters[index]);
-            index++;
-
-            if (j != count2 - 1)
-            {
-                ss << ", ";
-            }
-        }
-        ss << "},\n";
-    }
-    ss << "};\n";
-}
-
 static void print_max_material(std::stringstream& ss, const parameters_t& parameters)
 {
     ss << "const i32 max_material[] = {";
     for (auto i = 0; i < 6; i++)
     {
-#if TAPERED
-        const auto mg = parameters[i][static_cast<int>(PhaseStages::Midgame)];
-        const auto eg = parameters[i][static_cast<int>(PhaseStages::Endgame)];
+        const auto mg = parameters[material_term(i)][static_cast<int>(PhaseStages::Midgame)];
+        const auto eg = parameters[material_term(i)][static_cast<int>(PhaseStages::Endgame)];
         const auto max_material = round_value(max(mg, eg));
         ss << max_material << ", ";
-#else
-        const auto score = round_value(parameters[i]);
-        ss << score << ", ";
-#endif
     }
     ss << "0};" << endl;
 }
@@ -558,10 +539,8 @@ static void rebalance_psts(parameters_t& parameters, const int32_t pst_offset, b
     for (auto pieceIndex = 0; pieceIndex < 5; pieceIndex++)
     {
         const int pstStart = pst_offset + pieceIndex * pst_size;
-#if TAPERED
         for (int stage = 0; stage < 2; stage++)
         {
-#endif
             double sum = 0;
             for (auto i = 0; i < pst_size; i++)
             {
@@ -570,20 +549,12 @@ static void rebalance_psts(parameters_t& parameters, const int32_t pst_offset, b
                     continue;
                 }
                 const auto pstIndex = pstStart + i;
-#if TAPERED
                 sum += parameters[pstIndex][stage];
-#else
-                sum += parameters[pstIndex];
-#endif
             }
 
             const auto average = sum / (pieceIndex == 0 && pawn_exclusion ? pst_size - 3 : pst_size);
             //const auto average = sum / pst_size;
-#if TAPERED
-            parameters[pieceIndex][stage] += average * quantization;
-#else
-            parameters[pieceIndex] += average * quantization;
-#endif
+            parameters[material_term(pieceIndex)][stage] += average * quantization;
             for (auto i = 0; i < pst_size; i++)
             {
                 if (pieceIndex == 0 && pawn_exclusion && (i == 0 || i == pst_size - 1 || i == pst_size - 2))
@@ -591,91 +562,59 @@ static void rebalance_psts(parameters_t& parameters, const int32_t pst_offset, b
                     continue;
                 }
                 const auto pstIndex = pstStart + i;
-#if TAPERED
                 parameters[pstIndex][stage] -= average;
-#else
-                parameters[pstIndex] -= average;
-#endif
             }
-#if TAPERED
         }
-#endif
     }
 }
 
 parameters_t FourkuEval::get_initial_parameters()
 {
-    parameters_t parameters;
-    get_initial_parameter_array(parameters, material, 6);
-    get_initial_parameter_array(parameters, pst_rank, 48);
-    get_initial_parameter_array(parameters, pst_file, 48);
-    get_initial_parameter_array(parameters, open_files, 10);
-    get_initial_parameter_array(parameters, mobilities, 5);
-    get_initial_parameter_array(parameters, king_attacks, 5);
-    get_initial_parameter_array(parameters, pawn_protection, 6);
-    get_initial_parameter_array(parameters, pawn_threat_penalty, 6);
-    get_initial_parameter_array(parameters, passers, 4);
-    get_initial_parameter_single(parameters, pawn_passed_protected);
-    get_initial_parameter_single(parameters, pawn_doubled_penalty);
-    get_initial_parameter_single(parameters, pawn_phalanx);
-    get_initial_parameter_array(parameters, pawn_passed_blocked_penalty, 4);
-    get_initial_parameter_array(parameters, pawn_passed_king_distance, 2);
-    get_initial_parameter_single(parameters, bishop_pair);
-    get_initial_parameter_array(parameters, king_shield, 2);
-    return parameters;
+    return layout.get_initial_parameters<phase_model_t>();
 }
 
 static coefficients_t get_coefficients(const Trace& trace)
 {
     coefficients_t coefficients;
-    get_coefficient_array(coefficients, trace.material, 6);
-    get_coefficient_array(coefficients, trace.pst_rank, 48);
-    get_coefficient_array(coefficients, trace.pst_file, 48);
-    get_coefficient_array(coefficients, trace.open_files, 10);
-    get_coefficient_array(coefficients, trace.mobilities, 5);
-    get_coefficient_array(coefficients, trace.king_attacks, 5);
-    get_coefficient_array(coefficients, trace.pawn_protection, 6);
-    get_coefficient_array(coefficients, trace.pawn_threat_penalty, 6);
-    get_coefficient_array(coefficients, trace.passers, 4);
-    get_coefficient_single(coefficients, trace.pawn_passed_protected);
-    get_coefficient_single(coefficients, trace.pawn_doubled_penalty);
-    get_coefficient_single(coefficients, trace.pawn_phalanx);
-    get_coefficient_array(coefficients, trace.pawn_passed_blocked_penalty, 4);
-    get_coefficient_array(coefficients, trace.pawn_passed_king_distance, 2);
-    get_coefficient_single(coefficients, trace.bishop_pair);
-    get_coefficient_array(coefficients, trace.king_shield, 2);
+    get_trace_coefficients(coefficients, trace.terms);
     return coefficients;
 }
 
+std::vector<ParameterRange> FourkuEval::get_parameter_ranges()
+{
+    return layout.get_ranges();
+}
+
 void FourkuEval::print_parameters(const parameters_t& parameters)
 {
     parameters_t parameters_copy = parameters;
-    rebalance_psts(parameters_copy, 6, true, 8, 8);
-    rebalance_psts(parameters_copy, 6 + 6 * 8, false, 8, 8);
+    rebalance_psts(parameters_copy, pst_rank_term(), true, 8, 8);
+    rebalance_psts(parameters_copy, pst_file_term(), false, 8, 8);
 
-    int index = 0;
     stringstream ss;
     print_max_material(ss, parameters_copy);
-    print_array(ss, parameters_copy, index, "material", 6);
-    print_pst(ss, parameters_copy, index, "pst_rank");
-    print_pst(ss, parameters_copy, index, "pst_file");
-    print_array(ss, parameters_copy, index, "open_files", 10);
-    print_array(ss, parameters_copy, index, "mobilities", 5);
-    print_array(ss, parameters_copy, index, "king_attacks", 5);
-    print_array(ss, parameters_copy, index, "pawn_protection", 6);
-    print_array(ss, parameters_copy, index, "pawn_threat_penalty", 6);
-    print_array(ss, parameters_copy, index, "passers", 4);
-    print_single(ss, parameters_copy, index, "pawn_passed_protected");
-    print_single(ss, parameters_copy, index, "pawn_doubled_penalty");
-    print_single(ss, parameters_copy, index, "pawn_phalanx");
-    print_array(ss, parameters_copy, index, "pawn_passed_blocked_penalty", 4);
-    print_array(ss, parameters_copy, index, "pawn_passed_king_distance", 2);
-    print_single(ss, parameters_copy, index, "bishop_pair");
-    print_array(ss, parameters_copy, index, "king_shield", 2);
+    layout.print([&](const ParameterTerm& term, int& index)
+    {
+        const auto name = string(term.name);
+        switch (term.shape)
+        {
+        case TermShape::Single:
+            print_single(ss, parameters_copy, index, name);
+            break;
+        case TermShape::Array:
+            print_array(ss, parameters_copy, index, name, term.size());
+            break;
+        case TermShape::Array2d:
+            print_pst(ss, parameters_copy, index, name);
+            break;
+        default:
+            throw logic_error("Unsupported parameter term shape");
+        }
+    });
     cout << ss.str() << "\n";
 }
 
-Position get_position_from_external(const chess::Board& board)
+static Position get_position_from_external(const chess::Board& board)
 {
     Position position;
 
@@ -10,39 +10,46 @@
 using namespace std;
 using namespace Tcheran;
 
+using parameters_t = TcheranEval::parameters_t;
+
 using u64 = uint64_t;
 using i32 = int;
 
+constexpr auto material = layout.term("PIECE_VALUES");
+constexpr auto pst_pawn = layout.term("PAWNS");
+constexpr auto pst_knight = layout.term("KNIGHTS");
+constexpr auto pst_bishop = layout.term("BISHOPS");
+constexpr auto pst_rook = layout.term("ROOKS");
+constexpr auto pst_queen = layout.term("QUEENS");
+constexpr auto pst_king = layout.term("KING");
+constexpr auto knight_mobility = layout.term("KNIGHT_MOBILITY");
+constexpr auto bishop_mobility = layout.term("BISHOP_MOBILITY");
+constexpr auto rook_mobility = layout.term("ROOK_MOBILITY");
+constexpr auto queen_mobility = layout.term("QUEEN_MOBILITY");
+constexpr auto bishop_pair = layout.term("BISHOP_PAIR_BONUS");
+
+namespace
+{
 struct Trace
 {
     i32 score;
 
-    i32 material[6][2]{};
-
-    i32 pst_pawn[64][2]{};
-    i32 pst_knight[64][2]{};
-    i32 pst_bishop[64][2]{};
-    i32 pst_rook[64][2]{};
-    i32 pst_queen[64][2]{};
-    i32 pst_king[64][2]{};
-
-    i32 knight_mobility[9][2]{};
-    i32 bishop_mobility[14][2]{};
-    i32 rook_mobility[15][2]{};
-    i32 queen_mobility[28][2]{};
-
-    i32 bishop_pair[2]{};
+    ParameterTrace<layout.parameter_count()> terms{};
 };
+}
 
 const i32 phases[] = {0, 1, 1, 2, 4, 0};
 
-#define TRACE_INCR(parameter) trace.parameter[color]++
-#define TRACE_ADD(parameter, count) trace.parameter[color] += count
+#define TRACE_INCR(parameter) trace.terms[parameter][color]++
+#define TRACE_ADD(parameter, count) trace.terms[parameter][color] += count
 
+namespace
+{
 struct EvalForColorResult {
     int score;
     int phase;
 };
+}
 
 void trace_for_color(const chess::Board& board, chess::Color c, Trace& trace) {
     int color = c == chess::Color::WHITE ? 0 : 1;
@@ -54,8 +61,8 @@ void trace_for_color(const chess::Board& board, chess::Color c, Trace& trace) {
         auto sq = chess::Square(pawns.pop());
         if (shouldFlip) { sq.flip(); }
 
-        TRACE_INCR(material[0]);
-        TRACE_INCR(pst_pawn[sq.index()]);
+        TRACE_INCR(material(0));
+        TRACE_INCR(pst_pawn(sq.index()));
     }
 
     // Knights
@@ -64,11 +71,11 @@ void trace_for_color(const chess::Board& board, chess::Color c, Trace& trace) {
         auto sq = chess::Square(knights.pop());
         if (shouldFlip) { sq.flip(); }
 
-        TRACE_INCR(material[1]);
-        TRACE_INCR(pst_knight[sq.index()]);
+        TRACE_INCR(material(1));
+        TRACE_INCR(pst_knight(sq.index()));
 
         auto mobility = chess::attacks::knight(sq).count();
-        TRACE_INCR(knight_mobility[mobility]);
+        TRACE_INCR(knight_mobility(mobility));
     }
 
     // Bishops
@@ -80,15 +87,15 @@ void trace_for_color(const chess::Board& board, chess::Color c, Trace& trace) {
 
         bishop_count += 1;
 
-        TRACE_INCR(material[2]);
-        TRACE_INCR(pst_bishop[sq.index()]);
+        TRACE_INCR(material(2));
+        TRACE_INCR(pst_bishop(sq.index()));
 
         auto mobility = chess::attacks::bishop(sq, board.occ()).count();
-        TRACE_INCR(bishop_mobility[mobility]);
+        TRACE_INCR(bishop_mobility(mobility));
     }
 
     if (bishop_count > 1) {
-        TRACE_INCR(bishop_pair);
+        TRACE_INCR(bishop_pair());
     }
 
     // Rooks
@@ -97,11 +104,11 @@ void trace_for_color(const chess::Board& board, chess::Color c, Trace& trace) {
         auto sq = chess::Square(rooks.pop());
         if (shouldFlip) { sq.flip(); }
 
-        TRACE_INCR(material[3]);
-        TRACE_INCR(pst_rook[sq.index()]);
+        TRACE_INCR(material(3));
+        TRACE_INCR(pst_rook(sq.index()));
 
         auto mobility = chess::attacks::rook(sq, board.occ()).count();
-        TRACE_INCR(rook_mobility[mobility]);
+        TRACE_INCR(rook_mobility(mobility));
     }
 
     // Queens
@@ -110,11 +117,11 @@ void trace_for_color(const chess::Board& board, chess::Color c, Trace& trace) {
         auto sq = chess::Square(queens.pop());
         if (shouldFlip) { sq.flip(); }
 
-        TRACE_INCR(material[4]);
-        TRACE_INCR(pst_queen[sq.index()]);
+        TRACE_INCR(material(4));
+        TRACE_INCR(pst_queen(sq.index()));
 
         auto mobility = (chess::attacks::rook(sq, board.occ()) | chess::attacks::bishop(sq, board.occ())).count();
-        TRACE_INCR(queen_mobility[mobility]);
+        TRACE_INCR(queen_mobility(mobility));
     }
 
     // Kings
@@ -123,7 +130,7 @@ void trace_for_color(const chess::Board& board, chess::Color c, Trace& trace) {
         auto sq = chess::Square(kings.pop());
         if (shouldFlip) { sq.flip(); }
 
-        TRACE_INCR(pst_king[sq.index()]);
+        TRACE_INCR(pst_king(sq.index()));
     }
 }
 
@@ -261,105 +268,53 @@ static void print_array_2d(std::stringstream& ss, const parameters_t& parameters
     ss << "};\n";
 }
 
-void get_zeros_parameter_array(parameters_t& parameters, const int size)
-{
-    for (int i = 0; i < size; i++)
-    {
-        get_initial_parameter_single(parameters, 0);
-    }
-}
-
 parameters_t TcheranEval::get_initial_parameters()
 {
-    parameters_t parameters;
-
-    // Material
-    get_zeros_parameter_array(parameters, 6);
-
-    // Pawn PST
-    get_zeros_parameter_array(parameters, 64);
-
-    // Knight PST
-    get_zeros_parameter_array(parameters, 64);
-
-    // Bishop PST
-    get_zeros_parameter_array(parameters, 64);
-
-    // Rook PST
-    get_zeros_parameter_array(parameters, 64);
-
-    // Queen PST
-    get_zeros_parameter_array(parameters, 64);
-
-    // King PST
-    get_zeros_parameter_array(parameters, 64);
-
-    // Knight mobility
-    get_zeros_parameter_array(parameters, 9);
-
-    // Bishop mobility
-    get_zeros_parameter_array(parameters, 14);
-
-    // Rook mobility
-    get_zeros_parameter_array(parameters, 15);
-
-    // Queen mobility
-    get_zeros_parameter_array(parameters, 28);
-
-    // Bishop pair
-    get_initial_parameter_single(parameters, 0);
-    return parameters;
+    return layout.get_initial_parameters<phase_model_t>();
 }
 
 static coefficients_t get_coefficients(const Trace& trace)
 {
     coefficients_t coefficients;
-
-    get_coefficient_array(coefficients, trace.material, 6);
-
-    get_coefficient_array(coefficients, trace.pst_pawn, 64);
-    get_coefficient_array(coefficients, trace.pst_knight, 64);
-    get_coefficient_array(coefficients, trace.pst_bishop, 64);
-    get_coefficient_array(coefficients, trace.pst_rook, 64);
-    get_coefficient_array(coefficients, trace.pst_queen, 64);
-    get_coefficient_array(coefficients, trace.pst_king, 64);
-
-    get_coefficient_array(coefficients, trace.knight_mobility, 9);
-    get_coefficient_array(coefficients, trace.bishop_mobility, 14);
-    get_coefficient_array(coefficients, trace.rook_mobility, 15);
-    get_coefficient_array(coefficients, trace.queen_mobility, 28);
-
-    get_coefficient_single(coefficients, trace.bishop_pair);
-
+    get_trace_coefficients(coefficients, trace.terms);
     return coefficients;
 }
 
+std::vector<ParameterRange> TcheranEval::get_parameter_ranges()
+{
+    return layout.get_ranges();
+}
+
 void TcheranEval::print_parameters(const parameters_t& ps)
 {
     parameters_t parameters = ps;
-    rebalance_psts(parameters, 0, 6, true, 64, 1);
-    rebalance_psts(parameters, 1, 6 + 64 * 1, false, 64, 1);
-    rebalance_psts(parameters, 2, 6 + 64 * 2, false, 64, 1);
-    rebalance_psts(parameters, 3, 6 + 64 * 3, false, 64, 1);
-    rebalance_psts(parameters, 4, 6 + 64 * 4, false, 64, 1);
-    // rebalance_psts(parameters, 5, 6 + 64 * 5, false, 64, 1);
-
-    int index = 0;
+    rebalance_psts(parameters, material(0), pst_pawn(), true, 64, 1);
+    rebalance_psts(parameters, material(1), pst_knight(), false, 64, 1);
+    rebalance_psts(parameters, material(2), pst_bishop(), false, 64, 1);
+    rebalance_psts(parameters, material(3), pst_rook(), false, 64, 1);
+    rebalance_psts(parameters, material(4), pst_queen(), false, 64, 1);
+    // rebalance_psts(parameters, material(5), pst_king(), false, 64, 1);
+
     stringstream ss;
-    print_array(ss, parameters, index, "PIECE_VALUES", 6, "PieceKind::N");
-    print_pst(ss, parameters, index, "PAWNS");
-    print_pst(ss, parameters, index, "KNIGHTS");
-    print_pst(ss, parameters, index, "BISHOPS");
-    print_pst(ss, parameters, index, "ROOKS");
-    print_pst(ss, parameters, index, "QUEENS");
-    print_pst(ss, parameters, index, "KING");
-
-    print_array(ss, parameters, index, "KNIGHT_MOBILITY", 9, "9");
-    print_array(ss, parameters, index, "BISHOP_MOBILITY", 14, "14");
-    print_array(ss, parameters, index, "ROOK_MOBILITY", 15, "15");
-    print_array(ss, parameters, index, "QUEEN_MOBILITY", 28, "28");
-
-    print_single(ss, parameters, index, "BISHOP_PAIR_BONUS");
+    layout.print([&](const ParameterTerm& term, int& index)
+    {
+        const auto name = string(term.name);
+        switch (term.shape)
+        {
+        case TermShape::Single:
+            print_single(ss, parameters, index, name);
+            break;
+        case TermShape::Array:
+            print_array(ss, parameters, index, name, term.size(), term.size_name.empty() ? to_string(term.size1) : string(term.size_name));
+            break;
+        case TermShape::Array2d:
+            print_array_2d(ss, parameters, index, name, term.size1, term.size2);
+            break;
+        case TermShape::Pst:
+            print_pst(ss, parameters, index, name);
+            break;
+        }
+    });
     cout << ss.str() << "\n";
 }
 
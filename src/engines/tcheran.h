@@ -1,8 +1,6 @@
 #ifndef TCHERAN_H
 #define TCHERAN_H
 
-#define TAPERED 1
-
 #include "../base.h"
 #include "../external/chess.hpp"
 
@@ -11,9 +9,28 @@
 
 namespace Tcheran
 {
+    constexpr auto layout = make_parameter_layout(
+        ParameterTerm{ "PIECE_VALUES", TermShape::Array, 6, 1, "PieceKind::N" },
+        ParameterTerm{ "PAWNS", TermShape::Pst, 64 },
+        ParameterTerm{ "KNIGHTS", TermShape::Pst, 64 },
+        ParameterTerm{ "BISHOPS", TermShape::Pst, 64 },
+        ParameterTerm{ "ROOKS", TermShape::Pst, 64 },
+        ParameterTerm{ "QUEENS", TermShape::Pst, 64 },
+        ParameterTerm{ "KING", TermShape::Pst, 64 },
+        ParameterTerm{ "KNIGHT_MOBILITY", TermShape::Array, 9 },
+        ParameterTerm{ "BISHOP_MOBILITY", TermShape::Array, 14 },
+        ParameterTerm{ "ROOK_MOBILITY", TermShape::Array, 15 },
+        ParameterTerm{ "QUEEN_MOBILITY", TermShape::Array, 28 },
+        ParameterTerm{ "BISHOP_PAIR_BONUS", TermShape::Single }
+    );
+
     class TcheranEval
     {
     public:
+        using phase_model_t = TaperedPhase;
+        using parameters_t = Parameters<phase_model_t>;
+
+        constexpr static int32_t parameter_count = layout.parameter_count();
         constexpr static bool includes_additional_score = false;
         constexpr static bool supports_external_chess_eval = true;
         constexpr static bool retune_from_zero = true;
@@ -30,6 +47,8 @@ namespace Tcheran
 
         static parameters_t get_initial_parameters();
 
+        static std::vector<ParameterRange> get_parameter_ranges();
+
         static EvalResult get_fen_eval_result(const std::string &fen)
         {
             chess::Board board;
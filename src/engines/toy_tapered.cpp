@@ -6,20 +6,37 @@
 #include <sstream>
 #include <stdexcept>
 
-#if TAPERED
-
 using namespace std;
 using namespace Toy;
 
-struct Trace
+using parameters_t = ToyEvalTapered::parameters_t;
+
+static constexpr int32_t S(const int32_t mg, const int32_t eg)
 {
-    int32_t material[6][2]{};
-    int32_t bishop_pair[2]{};
-};
+    return packed_score(mg, eg);
+}
 
 constexpr std::array<int32_t, 6> material = { S(100, 100), S(300, 300), S(300, 300), S(500, 500), S(900, 900) };
 constexpr int32_t bishop_pair = S(25, 25);
 
+// The bishop pair is worth the same in every phase
+constexpr auto layout = make_parameter_layout(
+    ParameterTerm{ "material", TermShape::Array, 6, 1, "", material.data() },
+    ParameterTerm{ "bishop_pair", TermShape::Single, 1, 1, "", &bishop_pair, false }
+);
+static_assert(layout.parameter_count() == ToyEvalTapered::parameter_count, "Parameter layout doesn't match parameter_count");
+
+constexpr auto material_term = layout.term("material");
+constexpr auto bishop_pair_term = layout.term("bishop_pair");
+
+namespace
+{
+struct Trace
+{
+    ParameterTrace<layout.parameter_count()> terms{};
+};
+}
+
 static Trace trace_evaluate(const Position& position)
 {
     Trace trace{};
@@ -37,7 +54,7 @@ static Trace trace_evaluate(const Position& position)
         if (piece < Pieces::BlackPawn)
         {
             const int materialIndex = static_cast<int>(piece) - static_cast<int>(Pieces::WhitePawn);
-            trace.material[materialIndex][0]++;
+            trace.terms[material_term(materialIndex)][0]++;
 
             if (piece == Pieces::WhiteBishop)
             {
@@ -47,7 +64,7 @@ static Trace trace_evaluate(const Position& position)
         else
         {
             const int materialIndex = static_cast<int>(piece) - static_cast<int>(Pieces::BlackPawn);
-            trace.material[materialIndex][1]++;
+            trace.terms[material_term(materialIndex)][1]++;
 
             if (piece == Pieces::BlackBishop)
             {
@@ -58,7 +75,7 @@ static Trace trace_evaluate(const Position& position)
 
     for (int color = 0; color < 2; color++)
     {
-        trace.bishop_pair[color] += bishop_counts[color] == 2;
+        trace.terms[bishop_pair_term()][color] += bishop_counts[color] == 2;
     }
 
     return trace;
@@ -67,17 +84,18 @@ static Trace trace_evaluate(const Position& position)
 static coefficients_t get_coefficients(const Trace& trace)
 {
     coefficients_t coefficients;
-    get_coefficient_array(coefficients, trace.material, 6);
-    get_coefficient_single(coefficients, trace.bishop_pair);
+    get_trace_coefficients(coefficients, trace.terms);
     return coefficients;
 }
 
 parameters_t ToyEvalTapered::get_initial_parameters()
 {
-    parameters_t parameters;
-    get_initial_parameter_array(parameters, material, material.size());
-    get_initial_parameter_single(parameters, bishop_pair);
-    return parameters;
+    return layout.get_initial_parameters<phase_model_t>();
+}
+
+std::vector<ParameterRange> ToyEvalTapered::get_parameter_ranges()
+{
+    return layout.get_ranges();
 }
 
 EvalResult ToyEvalTapered::get_fen_eval_result(const string& fen)
@@ -91,7 +109,7 @@ EvalResult ToyEvalTapered::get_fen_eval_result(const string& fen)
     return result;
 }
 
-EvalResult ToyEvalTapered::get_external_eval_result(const chess::Board& board)
+EvalResult ToyEvalTapered::get_external_eval_result([[maybe_unused]] const chess::Board& board)
 {
     throw std::runtime_error("Not implemented");
 }
@@ -127,10 +145,21 @@ static void print_array(std::stringstream& ss, const parameters_t& parameters, i
 
 void ToyEvalTapered::print_parameters(const parameters_t& parameters)
 {
-    int index = 0;
     stringstream ss;
-    print_array(ss, parameters, index, "material", 6);
-    print_single(ss, parameters, index, "bishop_pair");
+    layout.print([&](const ParameterTerm& term, int& index)
+    {
+        const auto name = string(term.name);
+        switch (term.shape)
+        {
+        case TermShape::Single:
+            print_single(ss, parameters, index, name);
+            break;
+        case TermShape::Array:
+            print_array(ss, parameters, index, name, term.size());
+            break;
+        default:
+            throw logic_error("Unsupported parameter term shape");
+        }
+    });
     cout << ss.str() << "\n";
 }
-#endif
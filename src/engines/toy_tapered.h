@@ -1,20 +1,21 @@
 #ifndef TOY_TAPERED_H
 #define TOY_TAPERED_H 1
 
-#define TAPERED 1
-
 #include "../base.h"
 #include "../external/chess.hpp"
 
 #include <string>
 #include <vector>
 
-#if TAPERED
 namespace Toy
 {
     class ToyEvalTapered
     {
     public:
+        using phase_model_t = TaperedPhase;
+        using parameters_t = Parameters<phase_model_t>;
+
+        constexpr static int32_t parameter_count = 7;
         constexpr static bool includes_additional_score = false;
         constexpr static bool supports_external_chess_eval = false;
         constexpr static bool retune_from_zero = false;
@@ -25,13 +26,15 @@ namespace Toy
         constexpr static tune_t initial_learning_rate = 1;
         constexpr static int32_t learning_rate_drop_interval = 10000;
         constexpr static tune_t learning_rate_drop_ratio = 1;
+        constexpr static bool print_data_entries = false;
+        constexpr static int32_t data_load_print_interval = 10000;
 
         static parameters_t get_initial_parameters();
+        static std::vector<ParameterRange> get_parameter_ranges();
         static EvalResult get_fen_eval_result(const std::string& fen);
         static EvalResult get_external_eval_result(const chess::Board& board);
         static void print_parameters(const parameters_t& parameters);
     };
 }
-#endif
 
 #endif // !TOY_TAPERED_H
@@ -3197,6 +3197,8 @@ class StreamParser {
    private:
     class LineBuffer {
        public:
+        LineBuffer() {}
+
         bool empty() const { return index_ == 0; }
 
         void clear() { index_ = 0; }
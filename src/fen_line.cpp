@@ -0,0 +1,187 @@
+#include "fen_line.h"
+
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace
+{
+
+struct WdlMarker
+{
+    string_view marker;
+    double wdl;
+};
+
+constexpr array<WdlMarker, 4> markers
+{
+    WdlMarker{"1.0", 1},
+
+    WdlMarker{"1-0", 1},
+    WdlMarker{"1/2-1/2", 0.5},
+    WdlMarker{"0-1", 0}
+};
+
+bool is_token_separator(const char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+string_view trim_result_token(string_view token)
+{
+    while (!token.empty() && (token.front() == '[' || token.front() == '"' || token.front() == '('))
+    {
+        token.remove_prefix(1);
+    }
+
+    while (!token.empty() && (token.back() == ']' || token.back() == '"' || token.back() == ')' || token.back() == ';' || token.back() == ','))
+    {
+        token.remove_suffix(1);
+    }
+
+    return token;
+}
+
+// Lines where the WDL isn't a field of its own, like "... 0 1;1.0", are searched for the markers anywhere after
+// the board fields, as the tuner always did before parsing the fields
+bool find_wdl_in_text(const string_view line, const string_view text, double& wdl)
+{
+    bool marker_found = false;
+    for (const auto& marker : markers)
+    {
+        if (text.find(marker.marker) == string_view::npos)
+        {
+            continue;
+        }
+
+        if (marker_found && wdl != marker.wdl)
+        {
+            cout << "WDL marker already found on line " << line << endl;
+            throw runtime_error("WDL marker already found");
+        }
+        marker_found = true;
+        wdl = marker.wdl;
+    }
+
+    if (marker_found)
+    {
+        return true;
+    }
+
+    // The last probability wins, which is the result in "... 0 1;0.6"
+    bool probability_found = false;
+    for (auto position = text.find("0."); position != string_view::npos; position = text.find("0.", position + 1))
+    {
+        if (position > 0 && isdigit(static_cast<unsigned char>(text[position - 1])))
+        {
+            continue;
+        }
+
+        double probability;
+        const auto parse_result = from_chars(text.data() + position, text.data() + text.size(), probability);
+        if (parse_result.ec == errc())
+        {
+            probability_found = true;
+            wdl = probability;
+        }
+    }
+
+    return probability_found;
+}
+
+}
+
+FenLine parse_fen_line(const string_view line, const bool side_to_move_wdl)
+{
+    FenLine result{};
+    bool marker_found = false;
+    bool probability_found = false;
+    double probability = 0;
+    int32_t token_index = 0;
+    size_t position = 0;
+
+    while (position < line.size())
+    {
+        while (position < line.size() && is_token_separator(line[position]))
+        {
+            position++;
+        }
+
+        const auto token_start = position;
+        while (position < line.size() && !is_token_separator(line[position]))
+        {
+            position++;
+        }
+
+        if (token_start == position)
+        {
+            break;
+        }
+
+        const auto token = line.substr(token_start, position - token_start);
+        if (token_index == 1)
+        {
+            result.white_to_move = token.front() == 'w';
+        }
+        else if (token_index == 3)
+        {
+            result.fen = line.substr(0, position);
+        }
+        else if (token_index > 3)
+        {
+            const auto result_token = trim_result_token(token);
+            for (const auto& marker : markers)
+            {
+                if (result_token == marker.marker)
+                {
+                    if (marker_found && result.wdl != marker.wdl)
+                    {
+                        cout << "WDL marker already found on line " << line << endl;
+                        throw runtime_error("WDL marker already found");
+                    }
+                    marker_found = true;
+                    result.wdl = marker.wdl;
+                }
+            }
+
+            if (result_token.starts_with("0."))
+            {
+                const auto parse_result = from_chars(result_token.data(), result_token.data() + result_token.size(), probability);
+                probability_found |= parse_result.ec == errc();
+            }
+        }
+
+        token_index++;
+    }
+
+    if (token_index < 4)
+    {
+        cout << "FEN is incomplete on line " << line << endl;
+        throw runtime_error("FEN is incomplete");
+    }
+
+    if (!marker_found)
+    {
+        if (probability_found)
+        {
+            result.wdl = probability;
+        }
+        else if (!find_wdl_in_text(line, line.substr(result.fen.size()), result.wdl))
+        {
+            cout << "WDL marker not found on line " << line << endl;
+            throw runtime_error("WDL marker not found");
+        }
+    }
+
+    if (!result.white_to_move && side_to_move_wdl)
+    {
+        result.wdl = 1 - result.wdl;
+    }
+
+    return result;
+}
@@ -0,0 +1,18 @@
+#ifndef FEN_LINE_H
+#define FEN_LINE_H 1
+
+#include <string_view>
+
+struct FenLine
+{
+    // Piece placement, side to move, castling and en passant fields
+    std::string_view fen;
+    bool white_to_move;
+    double wdl;
+};
+
+// Splits a data line into the board fields, side to move and WDL in a single pass without allocating.
+// The returned FEN points into line.
+FenLine parse_fen_line(std::string_view line, bool side_to_move_wdl);
+
+#endif // !FEN_LINE_H
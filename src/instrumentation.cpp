@@ -0,0 +1,104 @@
+#include "instrumentation.h"
+
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+using namespace std;
+using namespace Instrumentation;
+
+namespace
+{
+
+constexpr array<const char*, stage_count> stage_names =
+{
+    "read",
+    "parse",
+    "qsearch",
+    "trace",
+    "entry_build",
+    "merge",
+    "k_search",
+    "gradient",
+    "reduction",
+    "optimizer"
+};
+
+// Every thread which ever recorded a stage, deque keeps the counters in place as threads register
+mutex registry_mutex;
+deque<ThreadCounters> registry;
+
+ThreadCounters& register_thread()
+{
+    lock_guard lock(registry_mutex);
+    return registry.emplace_back();
+}
+
+}
+
+ThreadCounters& Instrumentation::get_thread_counters()
+{
+    thread_local ThreadCounters& counters = register_thread();
+    return counters;
+}
+
+void Instrumentation::write_json(const string& path, const double elapsed_seconds)
+{
+    const auto temporary_path = path + ".tmp";
+    {
+        ofstream output(temporary_path);
+        if (!output)
+        {
+            cout << "Failed to open " << temporary_path << endl;
+            throw runtime_error("Failed to open instrumentation output");
+        }
+
+        lock_guard lock(registry_mutex);
+        output << "{" << endl;
+        output << "  \"elapsed_seconds\": " << elapsed_seconds << "," << endl;
+        output << "  \"threads\": " << registry.size() << "," << endl;
+        output << "  \"stages\": [";
+        for (int32_t stage = 0; stage < stage_count; stage++)
+        {
+            int64_t total_nanoseconds = 0;
+            int64_t total_calls = 0;
+            int64_t total_items = 0;
+            for (const auto& counters : registry)
+            {
+                total_nanoseconds += counters.nanoseconds[stage].load(memory_order_relaxed);
+                total_calls += counters.calls[stage].load(memory_order_relaxed);
+                total_items += counters.items[stage].load(memory_order_relaxed);
+            }
+
+            output << (stage == 0 ? "" : ",") << endl;
+            output << "    { \"name\": \"" << stage_names[stage] << "\", \"seconds\": " << total_nanoseconds / 1e9;
+            output << ", \"calls\": " << total_calls << ", \"items\": " << total_items << ", \"threads\": [";
+            bool first = true;
+            for (size_t thread_index = 0; thread_index < registry.size(); thread_index++)
+            {
+                const auto& counters = registry[thread_index];
+                const auto calls = counters.calls[stage].load(memory_order_relaxed);
+                if (calls == 0)
+                {
+                    continue;
+                }
+
+                output << (first ? "" : ", ") << "{ \"thread\": " << thread_index;
+                output << ", \"seconds\": " << counters.nanoseconds[stage].load(memory_order_relaxed) / 1e9;
+                output << ", \"calls\": " << calls << ", \"items\": " << counters.items[stage].load(memory_order_relaxed) << " }";
+                first = false;
+            }
+            output << "] }";
+        }
+        output << endl << "  ]" << endl << "}" << endl;
+    }
+
+    if (rename(temporary_path.c_str(), path.c_str()) != 0)
+    {
+        cout << "Failed to replace " << path << endl;
+        throw runtime_error("Failed to write instrumentation output");
+    }
+}
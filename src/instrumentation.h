@@ -0,0 +1,104 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H 1
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Time and item counts of the tuner's stages, summed per thread and exported as JSON.
+// The timers compile to nothing unless instrumentation is enabled in config.h.
+namespace Instrumentation
+{
+    // Stages nest: parse includes qsearch, trace and entry build of the positions it parses
+    enum class Stage
+    {
+        Read,
+        Parse,
+        Qsearch,
+        Trace,
+        EntryBuild,
+        Merge,
+        KSearch,
+        Gradient,
+        Reduction,
+        Optimizer,
+        Count
+    };
+
+    constexpr int32_t stage_count = static_cast<int32_t>(Stage::Count);
+
+    // Totals of one thread. Only the thread itself writes them, relaxed atomics let the export read them while it runs.
+    struct ThreadCounters
+    {
+        std::array<std::atomic<int64_t>, stage_count> nanoseconds{};
+        std::array<std::atomic<int64_t>, stage_count> calls{};
+        std::array<std::atomic<int64_t>, stage_count> items{};
+
+        void add(const Stage stage, const int64_t elapsed_nanoseconds, const int64_t item_count)
+        {
+            const auto index = static_cast<int32_t>(stage);
+            increment(nanoseconds[index], elapsed_nanoseconds);
+            increment(calls[index], 1);
+            increment(items[index], item_count);
+        }
+
+    private:
+        static void increment(std::atomic<int64_t>& counter, const int64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    };
+
+    // Counters of the calling thread, registered on its first call. They outlive the thread.
+    ThreadCounters& get_thread_counters();
+
+    // Writes the totals of every stage and their split over the threads, through a temporary file so that a
+    // reader never sees a partial export
+    void write_json(const std::string& path, double elapsed_seconds);
+
+    template<bool Enabled>
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(const Stage stage)
+            : stage(stage), start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~ScopedTimer()
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            get_thread_counters().add(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), items);
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+        void add_items(const int64_t count)
+        {
+            items += count;
+        }
+
+    private:
+        Stage stage;
+        std::chrono::steady_clock::time_point start;
+        int64_t items = 0;
+    };
+
+    template<>
+    class ScopedTimer<false>
+    {
+    public:
+        explicit ScopedTimer(Stage)
+        {
+        }
+
+        void add_items(int64_t)
+        {
+        }
+    };
+}
+
+#endif // !INSTRUMENTATION_H
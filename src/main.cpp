@@ -1,89 +1,73 @@
 #include "tuner.h"
 
-#include <fstream>
 #include <iostream>
 #include <string>
-#include <sstream>
 #include <vector>
 
 using namespace std;
 using namespace Tuner;
 
+static void print_engines()
+{
+    cout << "Available engines:";
+    for (const auto& engine : get_engines())
+    {
+        cout << " " << engine.name;
+    }
+    cout << endl;
+}
+
 int main(int argc, char** argv) {
     vector<DataSource> sources;
+
+    vector<string> args(argv + 1, argv + argc);
+    string engine_name = "tcheran";
+    if (args.size() > 1 && args[0] == "--engine")
     {
-        string csv_path = "sources.csv";
-        if (argc > 1)
-        {
-            csv_path = argv[1];
-        }
-        ifstream csv(csv_path);
-        if(!csv)
+        engine_name = args[1];
+        args.erase(args.begin(), args.begin() + 2);
+    }
+
+    const auto engine = find_engine(engine_name);
+    if (engine == nullptr)
+    {
+        cout << "Unknown engine " << engine_name << endl;
+        print_engines();
+        return -1;
+    }
+
+    if (!args.empty() && args[0] == "convert")
+    {
+        if (args.size() != 3)
         {
-            cout << "Unable to open data source list " << csv_path << endl;
+            cout << "Usage: tuner [--engine <name>] convert <sources.csv> <output.bin>" << endl;
+            return -1;
         }
 
-        while(!csv.eof())
+        const auto result = read_sources(args[1], sources);
+        if (result != 0)
         {
-            string line;
-            getline(csv, line);
-
-            if(line.empty() || line.starts_with('#'))
-            {
-                continue;
-            }
-
-            DataSource source;
-            stringstream ss(line);
-            if(!getline(ss, source.path, ','))
-            {
-                cout << "CSV misformatted" << endl;
-                return -1;
-            }
-
-            string flipped_wdl_str;
-            if (!getline(ss, flipped_wdl_str, ','))
-            {
-                cout << "CSV misformatted" << endl;
-                return -1;
-            }
-            try
-            {
-                source.side_to_move_wdl = stoul(flipped_wdl_str);
-            }
-            catch (const std::invalid_argument&)
-            {
-                cout << flipped_wdl_str << " is not valid for a WDL flip flag";
-                return -1;
-            }
+            return result;
+        }
 
-            string position_limit_str;
-            if (!getline(ss, flipped_wdl_str, ','))
-            {
-                cout << "CSV misformatted" << endl;
-                return -1;
-            }
-            try
-            {
-                source.position_limit = stoll(flipped_wdl_str);
-            }
-            catch (const std::invalid_argument&)
-            {
-                cout << position_limit_str << " is not a valid position limit";
-                return -1;
-            }
+        engine->convert(sources, args[2]);
+        return 0;
+    }
 
-            sources.push_back(source);
-        }
+    string csv_path = "sources.csv";
+    if (!args.empty())
+    {
+        csv_path = args[0];
     }
 
-    if(sources.empty())
+    const auto result = read_sources(csv_path, sources);
+    if (result != 0)
     {
-        cout << "Data source list is empty";
-        return -1;
+        return result;
     }
 
-    run(sources);
+    cout << "Tuning engine " << engine->name << endl;
+    engine->run(sources);
 
     return 0;
 }
\ No newline at end of file
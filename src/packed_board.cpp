@@ -0,0 +1,123 @@
+#include "packed_board.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+using namespace std;
+
+enum CastlingBits : uint8_t
+{
+    WhiteKingSide = 1,
+    WhiteQueenSide = 2,
+    BlackKingSide = 4,
+    BlackQueenSide = 8,
+    Chess960 = 16
+};
+
+using Side = chess::Board::CastlingRights::Side;
+
+struct CastlingRight
+{
+    chess::Color color;
+    Side side;
+    chess::File standard_file;
+};
+
+// In the order of the castling bits
+constexpr array<CastlingRight, 4> castling_rights =
+{
+    CastlingRight{ chess::Color::WHITE, Side::KING_SIDE, chess::File::FILE_H },
+    CastlingRight{ chess::Color::WHITE, Side::QUEEN_SIDE, chess::File::FILE_A },
+    CastlingRight{ chess::Color::BLACK, Side::KING_SIDE, chess::File::FILE_H },
+    CastlingRight{ chess::Color::BLACK, Side::QUEEN_SIDE, chess::File::FILE_A }
+};
+
+PackedBoard pack_board(const chess::Board& board)
+{
+    PackedBoard packed;
+    packed.occupancy = board.occ().getBits();
+
+    auto occupancy = board.occ();
+    int32_t piece_index = 0;
+    while (occupancy)
+    {
+        if (piece_index >= 32)
+        {
+            throw runtime_error("Too many pieces to pack board");
+        }
+
+        const auto square = chess::Square(occupancy.pop());
+        const auto piece = static_cast<uint8_t>(static_cast<int>(board.at(square).internal()));
+        packed.pieces[piece_index / 2] |= piece << ((piece_index % 2) * 4);
+        piece_index++;
+    }
+
+    packed.side_to_move = board.sideToMove() == chess::Color::WHITE ? 0 : 1;
+
+    const auto castling = board.castlingRights();
+    for (size_t right_index = 0; right_index < castling_rights.size(); right_index++)
+    {
+        const auto& right = castling_rights[right_index];
+        if (!castling.has(right.color, right.side))
+        {
+            continue;
+        }
+
+        packed.castling |= 1 << right_index;
+        const auto file = castling.getRookFile(right.color, right.side);
+        if (file != right.standard_file)
+        {
+            const auto nibble = static_cast<uint8_t>(static_cast<int>(file) + 1);
+            packed.castling_files[right_index / 2] |= nibble << ((right_index % 2) * 4);
+        }
+    }
+    packed.castling |= board.chess960() ? Chess960 : 0;
+
+    const auto en_passant = board.enpassantSq();
+    packed.en_passant = en_passant == chess::Square::underlying::NO_SQ ? 64 : static_cast<uint8_t>(en_passant.index());
+    packed.halfmove_clock = static_cast<uint8_t>(min<uint32_t>(board.halfMoveClock(), 255));
+
+    return packed;
+}
+
+void UnpackedBoard::unpack(const PackedBoard& packed)
+{
+    occ_bb_.fill(0ULL);
+    pieces_bb_.fill(0ULL);
+    board_.fill(chess::Piece::NONE);
+
+    auto occupancy = chess::Bitboard(packed.occupancy);
+    int32_t piece_index = 0;
+    while (occupancy)
+    {
+        const auto square = chess::Square(occupancy.pop());
+        const auto nibble = (packed.pieces[piece_index / 2] >> ((piece_index % 2) * 4)) & 0xF;
+        placePiece(chess::Piece(static_cast<chess::Piece::underlying>(nibble)), square);
+        piece_index++;
+    }
+
+    stm_ = packed.side_to_move == 0 ? chess::Color::WHITE : chess::Color::BLACK;
+
+    cr_.clear();
+    for (size_t right_index = 0; right_index < castling_rights.size(); right_index++)
+    {
+        const auto& right = castling_rights[right_index];
+        if (!(packed.castling & (1 << right_index)))
+        {
+            continue;
+        }
+
+        const auto nibble = (packed.castling_files[right_index / 2] >> ((right_index % 2) * 4)) & 0xF;
+        const auto file = nibble == 0 ? right.standard_file : chess::File(static_cast<chess::File::underlying>(nibble - 1));
+        cr_.setCastlingRight(right.color, right.side, file);
+    }
+    chess960_ = (packed.castling & Chess960) != 0;
+
+    ep_sq_ = packed.en_passant >= 64 ? chess::Square(chess::Square::underlying::NO_SQ) : chess::Square(packed.en_passant);
+
+    hfm_ = packed.halfmove_clock;
+    plies_ = stm_ == chess::Color::BLACK ? 1 : 0;
+    key_ = zobrist();
+    prev_states_.clear();
+}
@@ -0,0 +1,44 @@
+#ifndef PACKED_BOARD_H
+#define PACKED_BOARD_H 1
+
+#include "external/chess.hpp"
+
+#include <array>
+#include <cstdint>
+
+// Fixed-size 32 byte board representation. The occupancy bitboard gives the
+// squares which hold a piece, and pieces stores one nibble per occupied square
+// in ascending square order, using the chess::Piece numbering.
+// This is also the record layout of packed binary data sources.
+struct PackedBoard
+{
+    uint64_t occupancy = 0;
+    std::array<uint8_t, 16> pieces{};
+    uint8_t side_to_move = 0;
+    uint8_t castling = 0;
+    uint8_t en_passant = 64;
+    // WDL from white's point of view, scaled by packed_result_scale
+    uint8_t result = 0;
+    // Saturated at 255
+    uint8_t halfmove_clock = 0;
+    // File of the rook plus one for each castling right, one nibble each in the order of the castling bits.
+    // 0 stands for the H or A file, so files written before Chess960 support read as standard castling.
+    std::array<uint8_t, 2> castling_files{};
+    uint8_t reserved = 0;
+};
+
+static_assert(sizeof(PackedBoard) == 32, "PackedBoard is expected to be 32 bytes");
+
+constexpr int32_t packed_result_scale = 200;
+
+PackedBoard pack_board(const chess::Board& board);
+
+// chess::Board which can be filled directly from a PackedBoard without going
+// through a FEN string. A single instance is meant to be reused per thread.
+class UnpackedBoard : public chess::Board
+{
+public:
+    void unpack(const PackedBoard& packed);
+};
+
+#endif // !PACKED_BOARD_H
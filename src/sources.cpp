@@ -0,0 +1,88 @@
+#include "tuner.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace Tuner;
+
+int Tuner::read_sources(const string& csv_path, vector<DataSource>& sources)
+{
+    ifstream csv(csv_path);
+    if(!csv)
+    {
+        cout << "Unable to open data source list " << csv_path << endl;
+    }
+
+    while(!csv.eof())
+    {
+        string line;
+        getline(csv, line);
+
+        if(line.empty() || line.starts_with('#'))
+        {
+            continue;
+        }
+
+        DataSource source;
+        stringstream ss(line);
+        if(!getline(ss, source.path, ','))
+        {
+            cout << "CSV misformatted" << endl;
+            return -1;
+        }
+
+        if (source.path.ends_with(".pgn"))
+        {
+            source.format = DataSourceFormat::Pgn;
+        }
+        else if (source.path.ends_with(".bin"))
+        {
+            source.format = DataSourceFormat::Packed;
+        }
+
+        string flipped_wdl_str;
+        if (!getline(ss, flipped_wdl_str, ','))
+        {
+            cout << "CSV misformatted" << endl;
+            return -1;
+        }
+        try
+        {
+            source.side_to_move_wdl = stoul(flipped_wdl_str);
+        }
+        catch (const std::invalid_argument&)
+        {
+            cout << flipped_wdl_str << " is not valid for a WDL flip flag";
+            return -1;
+        }
+
+        string position_limit_str;
+        if (!getline(ss, flipped_wdl_str, ','))
+        {
+            cout << "CSV misformatted" << endl;
+            return -1;
+        }
+        try
+        {
+            source.position_limit = stoll(flipped_wdl_str);
+        }
+        catch (const std::invalid_argument&)
+        {
+            cout << position_limit_str << " is not a valid position limit";
+            return -1;
+        }
+
+        sources.push_back(source);
+    }
+
+    if(sources.empty())
+    {
+        cout << "Data source list is empty";
+        return -1;
+    }
+
+    return 0;
+}
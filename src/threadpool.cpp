@@ -1,4 +1,5 @@
 #include "threadpool.h"
+#include "trace_events.h"
 
 #include <cstdint>
 #include <thread>
@@ -9,7 +10,7 @@ void ThreadPool::start(uint32_t thread_count)
 {
     stop();
     should_stop = false;
-    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    for (uint32_t thread_index = 0; thread_index < thread_count; thread_index++)
     {
         threads.emplace_back([this]()
         {
@@ -56,6 +57,8 @@ bool ThreadPool::is_idle()
 
 void ThreadPool::wait_for_completion()
 {
+    // Time the calling thread spends waiting for the slowest job
+    TraceEvents::Span span("wait");
     unique_lock<mutex> lock(queue_mutex);
     while(!jobs.empty() || running_job_count > 0)
     {
@@ -88,7 +91,10 @@ void ThreadPool::thread_loop()
             running_job_count++;
         }
 
-        job();
+        {
+            TraceEvents::Span span("job");
+            job();
+        }
 
         {
             unique_lock<mutex> lock(queue_mutex);
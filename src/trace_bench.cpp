@@ -0,0 +1,62 @@
+#include "tuner.h"
+#include "config.h"
+#include "external/chess.hpp"
+
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+using namespace Tuner;
+
+namespace
+{
+
+int64_t get_trace_checksum(const EvalResult& eval_result)
+{
+    int64_t checksum = 0;
+    for (size_t index = 0; index < eval_result.coefficients.size(); index++)
+    {
+        checksum += eval_result.coefficients[index] * static_cast<int64_t>(index + 1);
+    }
+    return checksum;
+}
+
+}
+
+// Compiled once per engine like tuner.cpp, see add_tuner_engine in CMakeLists.txt
+namespace Tuner::TUNER_ENGINE
+{
+TraceBenchResult bench_traces(const vector<string>& fens, const int32_t iterations, const TracePath path)
+{
+    TraceBenchResult result;
+    if (path == TracePath::External && !TuneEval::supports_external_chess_eval)
+    {
+        return result;
+    }
+
+    vector<chess::Board> boards;
+    for (const auto& fen : fens)
+    {
+        boards.emplace_back(fen);
+    }
+
+    const auto start = high_resolution_clock::now();
+    for (int32_t iteration = 0; iteration < iterations; iteration++)
+    {
+        for (size_t position_index = 0; position_index < boards.size(); position_index++)
+        {
+            if (path == TracePath::Fen)
+            {
+                result.checksum += get_trace_checksum(TuneEval::get_fen_eval_result(fens[position_index]));
+            }
+            else if constexpr (TuneEval::supports_external_chess_eval)
+            {
+                result.checksum += get_trace_checksum(TuneEval::get_external_eval_result(boards[position_index]));
+            }
+        }
+    }
+    result.seconds = duration<double>(high_resolution_clock::now() - start).count();
+    result.positions = static_cast<int64_t>(iterations) * static_cast<int64_t>(boards.size());
+    return result;
+}
+}
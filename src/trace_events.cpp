@@ -0,0 +1,119 @@
+#include "trace_events.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace TraceEvents;
+
+namespace
+{
+
+atomic<bool> enabled = false;
+int32_t capacity = 0;
+steady_clock::time_point origin;
+
+// Written only by its thread. count is the number of events ever recorded, the buffer holds the latest of them.
+struct ThreadBuffer
+{
+    vector<Event> events;
+    atomic<int64_t> count = 0;
+};
+
+// deque keeps the buffers in place as threads register, they outlive their threads
+mutex registry_mutex;
+deque<ThreadBuffer> registry;
+
+ThreadBuffer& register_thread()
+{
+    lock_guard lock(registry_mutex);
+    auto& buffer = registry.emplace_back();
+    buffer.events.resize(capacity);
+    return buffer;
+}
+
+}
+
+void TraceEvents::start(const int32_t buffer_size)
+{
+    if (buffer_size <= 0)
+    {
+        throw runtime_error("Trace event buffers need room for at least one event");
+    }
+
+    capacity = buffer_size;
+    origin = steady_clock::now();
+    enabled.store(true, memory_order_release);
+}
+
+bool TraceEvents::is_enabled()
+{
+    return enabled.load(memory_order_acquire);
+}
+
+int64_t TraceEvents::get_time()
+{
+    return duration_cast<nanoseconds>(steady_clock::now() - origin).count();
+}
+
+void TraceEvents::record(const char* name, const int64_t start, const int64_t duration)
+{
+    thread_local ThreadBuffer& buffer = register_thread();
+    const auto count = buffer.count.load(memory_order_relaxed);
+    buffer.events[count % capacity] = Event{ name, start, duration };
+    buffer.count.store(count + 1, memory_order_release);
+}
+
+void TraceEvents::write_json(const string& path)
+{
+    const auto temporary_path = path + ".tmp";
+    {
+        ofstream output(temporary_path);
+        if (!output)
+        {
+            cout << "Failed to open " << temporary_path << endl;
+            throw runtime_error("Failed to open trace event output");
+        }
+
+        lock_guard lock(registry_mutex);
+        int64_t dropped_count = 0;
+        output << fixed << setprecision(3);
+        output << "{" << endl << "\"traceEvents\": [";
+        bool first = true;
+        for (size_t thread_index = 0; thread_index < registry.size(); thread_index++)
+        {
+            output << (first ? "" : ",") << endl;
+            output << "{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread_index;
+            output << ", \"args\": { \"name\": \"thread " << thread_index << "\" } }";
+            first = false;
+
+            const auto& buffer = registry[thread_index];
+            const auto count = buffer.count.load(memory_order_acquire);
+            const auto begin = max<int64_t>(count - capacity, 0);
+            dropped_count += begin;
+            for (auto event_index = begin; event_index < count; event_index++)
+            {
+                const auto& event = buffer.events[event_index % capacity];
+                output << "," << endl << "{ \"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread_index;
+                output << ", \"ts\": " << event.start / 1000.0 << ", \"dur\": " << event.duration / 1000.0 << " }";
+            }
+        }
+        output << endl << "]," << endl;
+        output << "\"displayTimeUnit\": \"ms\"," << endl;
+        output << "\"otherData\": { \"dropped_events\": " << dropped_count << " }" << endl << "}" << endl;
+    }
+
+    if (rename(temporary_path.c_str(), path.c_str()) != 0)
+    {
+        cout << "Failed to replace " << path << endl;
+        throw runtime_error("Failed to write trace event output");
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H 1
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Timeline of spans on every thread, written in the Chrome trace event format which chrome://tracing and
+// Perfetto open. Every thread records into its own ring buffer, which keeps its latest events.
+namespace TraceEvents
+{
+    struct Event
+    {
+        // Has to be a string literal, only the pointer is kept
+        const char* name;
+        int64_t start;
+        int64_t duration;
+    };
+
+    // Starts recording, with room for buffer_size events per thread
+    void start(int32_t buffer_size);
+
+    bool is_enabled();
+
+    // Adds a completed span to the buffer of the calling thread, times in nanoseconds since start
+    void record(const char* name, int64_t start, int64_t duration);
+
+    int64_t get_time();
+
+    // Writes the recorded events. Threads must not record at the same time, so it is called between thread pool jobs.
+    void write_json(const std::string& path);
+
+    // Records its lifetime as a span if recording is enabled, and costs a flag check if not
+    class Span
+    {
+    public:
+        explicit Span(const char* name)
+            : name(name), start(is_enabled() ? get_time() : -1)
+        {
+        }
+
+        ~Span()
+        {
+            if (start >= 0)
+            {
+                record(name, start, get_time() - start);
+            }
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name;
+        int64_t start;
+    };
+}
+
+#endif // !TRACE_EVENTS_H
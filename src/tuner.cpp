@@ -1,30 +1,74 @@
 #include "tuner.h"
 #include "config.h"
+#include "fen_line.h"
+#include "instrumentation.h"
+#include "packed_board.h"
 #include "threadpool.h"
+#include "trace_events.h"
 #include "external/chess.hpp"
 
+#include <algorithm>
 #include <array>
+#include <charconv>
+#include <atomic>
+#include <bit>
+#include <cctype>
 #include <chrono>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <span>
 #include <sstream>
 #include <stdexcept>
+#include <streambuf>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using namespace std;
 using namespace std::chrono;
 using namespace Tuner;
 
-#ifndef TAPERED
-static_assert(false, "Tuner requires TAPERED to be defined")
-#endif
+// Every engine gets its own copy of the tuner, which must not be visible to the others
+namespace
+{
+
+using Phase = TuneEval::phase_model_t;
+using parameters_t = TuneEval::parameters_t;
+using Instrumentation::Stage;
+using StageTimer = Instrumentation::ScopedTimer<enable_instrumentation>;
+using TraceSpan = TraceEvents::Span;
+
+constexpr int32_t parameter_count = TuneEval::parameter_count;
+static_assert(parameter_count > 0 && parameter_count <= numeric_limits<int16_t>::max() + 1, "Parameter indices have to fit in CoefficientEntry");
+
+// Padded so that every stage of StageArrays starts on a cache line
+constexpr int32_t padded_parameter_count = (parameter_count + 7) / 8 * 8;
 
-struct WdlMarker
+// Gradient and optimizer state, sized at compile time so it can live on the stack. Laid out as one
+// contiguous array per phase stage, so the reductions and the optimizer step run over plain arrays.
+struct alignas(64) StageArrays
 {
-    string marker;
-    tune_t wdl;
+    array<array<tune_t, padded_parameter_count>, Phase::stage_count> stages{};
+
+    array<tune_t, padded_parameter_count>& operator[](const int32_t stage)
+    {
+        return stages[stage];
+    }
+
+    const array<tune_t, padded_parameter_count>& operator[](const int32_t stage) const
+    {
+        return stages[stage];
+    }
 };
 
 struct CoefficientEntry
@@ -40,77 +84,41 @@ struct Entry
     bool white_to_move;
     //tune_t initial_eval;
     tune_t additional_score;
-#if TAPERED
-    int32_t phase;
-    tune_t endgame_scale;
-#endif
+    // Number of source positions merged into this entry, wdl is their average
+    tune_t weight = 1;
+    // Weight of every phase stage in the eval, empty for untapered engines
+    [[no_unique_address]] Phase::weights_t stage_weights;
 };
 
-static const array<WdlMarker, 4> markers
+// Source position of an entry before quiescence, kept so that the entry can be
+// rebuilt when the quiescence PV changes under the current parameters
+struct QuiescenceSource
 {
-    WdlMarker{"1.0", 1},
-
-    WdlMarker{"1-0", 1},
-    WdlMarker{"1/2-1/2", 0.5},
-    WdlMarker{"0-1", 0}
+    PackedBoard board;
+    uint64_t leaf_hash;
 };
 
-static tune_t get_fen_wdl(const string& original_fen, const bool original_white_to_move, const bool white_to_move, const bool side_to_move_wdl)
-{
-    tune_t wdl;
-    bool marker_found = false;
-    for (auto& marker : markers)
-    {
-        if (original_fen.find(marker.marker) != std::string::npos)
-        {
-            if (marker_found)
-            {
-                cout << "WDL marker already found on line " << original_fen << endl;
-                throw std::runtime_error("WDL marker already found");
-            }
-            marker_found = true;
-            wdl = marker.wdl;
-        }
-    }
+constexpr bool refresh_qsearch = TuneEval::enable_qsearch && qsearch_refresh_interval > 0;
 
-    if(!marker_found)
-    {
-        stringstream ss(original_fen);
-        while (!ss.eof())
-        {
-            string word;
-            ss >> word;
-            if (word.starts_with("0."))
-            {
-                wdl = stod(word);
-                marker_found = true;
-            }
-            else if (word.starts_with("[0."))
-            {
-                wdl = stod(word.substr(1, word.size() - 2));
-                marker_found = true;
-            }
-        }
-    }
+// Non-zero for parameters which are not tuned, set up before loading
+static vector<uint8_t> frozen_mask;
+// Untapered terms of a tapered engine, whose stages are tuned as one value
+static vector<ParameterRange> untapered_ranges;
+constexpr int32_t phase_bucket_count = 5;
 
-    if (!marker_found)
-    {
-        cout << "WDL marker not found on line " << original_fen << endl;
-        throw std::runtime_error("WDL marker not found");
-    }
+static_assert(data_read_thread_count + data_load_thread_count <= thread_count, "Data readers and parse workers have to run on the thread pool at the same time");
+static_assert(!(compact_coefficient_patterns && refresh_qsearch), "Compacted entries can't be rebuilt by re-quiescing their source positions");
+static_assert(!(stream_entries && (refresh_qsearch || deduplicate_positions || compact_coefficient_patterns)), "Streamed entries are written to disk while loading and can't be modified afterwards");
+static_assert(!(stream_entries && coordinate_block_size > 0), "Coordinate descent needs random access to the entries");
 
-    if(!original_white_to_move && side_to_move_wdl)
-    {
-        wdl = 1 - wdl;
-    }
+constexpr bool use_feature_index = coordinate_block_size > 0;
+constexpr bool use_eval_cache = use_feature_index && cache_entry_evals;
 
-    return wdl;
-}   
+template<typename Eval>
+constexpr bool has_batch_eval = requires(span<const chess::Board> boards, EvalBatch& batch) { Eval::get_external_eval_results(boards, batch); };
 
-static bool get_fen_color_to_move(const string& fen)
-{
-    return fen.find('w') != std::string::npos;
-}
+// Batched evals are optional for engines. Printed data entries need their evals in line with the positions.
+constexpr bool use_batch_eval = eval_batch_size > 0 && TuneEval::supports_external_chess_eval && has_batch_eval<TuneEval> && !print_data_entries;
 
 static void print_elapsed(high_resolution_clock::time_point start)
 {
@@ -120,189 +128,220 @@ static void print_elapsed(high_resolution_clock::time_point start)
     cout << "[" << elapsed_seconds << "s] ";
 }
 
-static void get_coefficient_entries(const coefficients_t& coefficients, vector<CoefficientEntry>& coefficient_entries, int32_t parameter_count)
+static void export_instrumentation(const high_resolution_clock::time_point start)
+{
+    if constexpr (enable_instrumentation)
+    {
+        Instrumentation::write_json(instrumentation_path, duration<double>(high_resolution_clock::now() - start).count());
+    }
+}
+
+static void export_trace_events()
+{
+    if constexpr (enable_trace_events)
+    {
+        TraceEvents::write_json(trace_events_path);
+    }
+}
+
+static void get_coefficient_entries(const coefficients_t& coefficients, vector<CoefficientEntry>& coefficient_entries)
 {
     if(coefficients.size() != parameter_count)
     {
         throw runtime_error("Parameter count mismatch");
     }
 
-    for (int16_t i = 0; i < coefficients.size(); i++)
+    for (int32_t i = 0; i < parameter_count; i++)
     {
         if (coefficients[i] == 0)
         {
             continue;
         }
 
-        const auto coefficient_entry = CoefficientEntry{coefficients[i], i};
+        const auto coefficient_entry = CoefficientEntry{coefficients[i], static_cast<int16_t>(i)};
         coefficient_entries.push_back(coefficient_entry);
     }
 }
 
 static tune_t linear_eval(const Entry& entry, const parameters_t& parameters)
 {
-    tune_t score = entry.additional_score;
-#if TAPERED 
-    tune_t midgame = 0;
-    tune_t endgame = 0;
+    array<tune_t, Phase::stage_count> stage_scores{};
     for (const auto& coefficient : entry.coefficients)
     {
-        midgame += coefficient.value * parameters[coefficient.index][static_cast<int32_t>(PhaseStages::Midgame)];
-        endgame += coefficient.value * parameters[coefficient.index][static_cast<int32_t>(PhaseStages::Endgame)] * entry.endgame_scale;
+        for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+        {
+            stage_scores[stage] += coefficient.value * Phase::get(parameters[coefficient.index], stage);
+        }
     }
-    score += (midgame * entry.phase + endgame * (24 - entry.phase)) / 24;
-#else
-    for (const auto& coefficient : entry.coefficients)
+
+    tune_t score = entry.additional_score;
+    for (int32_t stage = 0; stage < Phase::stage_count; stage++)
     {
-        score += coefficient.value * parameters[coefficient.index];
+        score += stage_scores[stage] * entry.stage_weights[stage];
     }
-#endif
-
     return score;
 }
 
-static int32_t get_phase(const string& fen)
+static int32_t get_phase(const chess::Board& board)
 {
     int32_t phase = 0;
-    auto stop = false;
-    for(const char ch : fen)
+    phase += board.pieces(chess::PieceType::KNIGHT).count();
+    phase += board.pieces(chess::PieceType::BISHOP).count();
+    phase += board.pieces(chess::PieceType::ROOK).count() * 2;
+    phase += board.pieces(chess::PieceType::QUEEN).count() * 4;
+    return phase;
+}
+
+// Counts positions rather than entries, an entry merged from duplicates counts with its weight
+class DatasetStatistics
+{
+public:
+    void add(const vector<Entry>& entries)
     {
-        if(stop)
+        for (auto& entry : entries)
         {
-            break;
-        }
+            if (entry.wdl == 1)
+            {
+                wins[entry.white_to_move] += entry.weight;
+            }
+            else if (entry.wdl == 0.5)
+            {
+                draws[entry.white_to_move] += entry.weight;
+            }
+            else if (entry.wdl == 0.0)
+            {
+                losses[entry.white_to_move] += entry.weight;
+            }
+            total[entry.white_to_move] += entry.weight;
+            wdls[entry.white_to_move] += entry.wdl * entry.weight;
 
-        switch (ch)
-        {
-        case 'n':
-        case 'N':
-            phase += 1;
-            break;
-        case 'b':
-        case 'B':
-            phase += 1;
-            break;
-        case 'r':
-        case 'R':
-            phase += 2;
-            break;
-        case 'q':
-        case 'Q':
-            phase += 4;
-            break;
-        case 'p':
-        case '/':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-            break;
-        case ' ':
-            stop = true;
-            break;
+            if (entry.coefficients.size() < min_parameters)
+            {
+                min_parameters = entry.coefficients.size();
+            }
+
+            if (entry.coefficients.size() > max_parameters)
+            {
+                max_parameters = entry.coefficients.size();
+            }
+
+            total_parameters += entry.coefficients.size();
         }
-    }
-    return phase;
-}
 
-static int32_t get_phase(const chess::Board& board)
-{
-    int32_t phase = 0;
+        entry_count += entries.size();
+    }
 
-    for(uint8_t square_num = 0; square_num < 64; ++square_num)
+    void print(const parameters_t& parameters) const
     {
-        const auto square = static_cast<chess::Square>(square_num);
-        const auto piece = board.at(square);
-        switch (piece)
+        const auto position_count = total[0] + total[1];
+        cout << "Dataset statistics:" << endl;
+        cout << "Total positions: " << position_count << endl;
+        cout << "Total entries: " << entry_count << endl;
+        for (int color = 1; color >= 0; color--)
         {
-        case chess::Piece(chess::Piece::WHITEKNIGHT):
-        case chess::Piece(chess::Piece::WHITEBISHOP):
-        case chess::Piece(chess::Piece::BLACKKNIGHT):
-        case chess::Piece(chess::Piece::BLACKBISHOP):
-            phase += 1;
-            break;
-        case chess::Piece(chess::Piece::WHITEROOK):
-        case chess::Piece(chess::Piece::BLACKROOK):
-            phase += 2;
-            break;
-        case chess::Piece(chess::Piece::WHITEQUEEN):
-        case chess::Piece(chess::Piece::BLACKQUEEN):
-            phase += 4;
-            break;
+            const auto color_name = color ? "White" : "Black";
+            cout << color_name << ": " << total[color] << " (" << (total[color] * 100.0 / position_count) << "%)" << endl;
+            cout << color_name << " 1.0: " << wins[color] << " (" << (wins[color] * 100.0 / position_count) << "%)" << endl;
+            cout << color_name << " 0.5: " << draws[color] << " (" << (draws[color] * 100.0 / position_count) << "%)" << endl;
+            cout << color_name << " 0.0: " << losses[color] << " (" << (losses[color] * 100.0 / position_count) << "%)" << endl;
+            cout << color_name << " avg: " << wdls[color] / total[color] << endl;
         }
-    }
 
-    return phase;
-}
+        auto avg_parameters = static_cast<tune_t>(total_parameters) / entry_count;
+        cout << "Parameters total: " << parameters.size() << endl;
+        cout << "Parameters min: " << min_parameters << endl;
+        cout << "Parameters max: " << max_parameters << endl;
+        cout << "Parameters avg: " << avg_parameters << endl;
 
-static void print_statistics(const parameters_t& parameters, const vector<Entry>& entries)
-{
-    array<size_t, 2> wins{};
-    array<size_t, 2> draws{};
-    array<size_t, 2> losses{};
-    array<size_t, 2> total{};
-    array<tune_t, 2> wdls{};
+        cout << endl;
+    }
+
+private:
+    array<double, 2> wins{};
+    array<double, 2> draws{};
+    array<double, 2> losses{};
+    array<double, 2> total{};
+    array<double, 2> wdls{};
+    size_t entry_count = 0;
 
     size_t min_parameters = std::numeric_limits<uint64_t>::max();
     size_t max_parameters = 0;
     size_t total_parameters = 0;
+};
 
-    for(auto& entry : entries)
+static EvalResult get_board_eval_result(const chess::Board& board)
+{
+    if constexpr (TuneEval::supports_external_chess_eval)
     {
-        if(entry.wdl == 1)
-        {
-            wins[entry.white_to_move]++;
-        }
-        else if(entry.wdl == 0.5)
-        {
-            draws[entry.white_to_move]++;
-        }
-        else if (entry.wdl == 0.0)
-        {
-            losses[entry.white_to_move]++;
-        }
-        total[entry.white_to_move]++;
-        wdls[entry.white_to_move] += entry.wdl;
-
-        if(entry.coefficients.size() < min_parameters)
-        {
-            min_parameters = entry.coefficients.size();
-        }
+        return TuneEval::get_external_eval_result(board);
+    }
+    else
+    {
+        auto fen = board.getFen();
+        return TuneEval::get_fen_eval_result(fen);
+    }
+}
 
-        if (entry.coefficients.size() > max_parameters)
+// Sets the additional score of an entry whose coefficients are filled in, given the engine's score of the position
+static void finish_entry(const parameters_t& parameters, const tune_t eval_score, Entry& entry)
+{
+    entry.additional_score = 0;
+    if constexpr (TuneEval::includes_additional_score)
+    {
+        const tune_t score = linear_eval(entry, parameters);
+        if constexpr (print_data_entries)
         {
-            max_parameters = entry.coefficients.size();
+            cout << " Eval: " << score << endl;
         }
+        entry.additional_score = eval_score - score;
+    }
 
-        total_parameters += entry.coefficients.size();
+    // Frozen parameters only contribute a constant score, so they are folded into the additional score
+    if (!frozen_mask.empty())
+    {
+        const tune_t full_score = linear_eval(entry, parameters);
+        erase_if(entry.coefficients, [](const CoefficientEntry& coefficient) { return frozen_mask[coefficient.index] != 0; });
+        entry.additional_score += full_score - linear_eval(entry, parameters);
     }
+}
 
-    cout << "Dataset statistics:" << endl;
-    cout << "Total positions: " << entries.size() << endl;
-    for(int color = 1; color >= 0; color--)
+static void build_entry(const chess::Board& board, const parameters_t& parameters, Entry& entry)
+{
+    EvalResult eval_result;
     {
-        const auto color_name = color ? "White" : "Black";
-        cout << color_name << ": " << total[color] << " (" << (total[color] * 100.0 / entries.size()) << "%)" << endl;
-        cout << color_name << " 1.0: " << wins[color] << " (" << (wins[color] * 100.0 / entries.size()) << "%)" << endl;
-        cout << color_name << " 0.5: " << draws[color] << " (" << (draws[color] * 100.0 / entries.size()) << "%)" << endl;
-        cout << color_name << " 0.0: " << losses[color] << " (" << (losses[color] * 100.0 / entries.size()) << "%)" << endl;
-        cout << color_name << " avg: " << wdls[color] / total[color] << endl;
+        StageTimer timer(Stage::Trace);
+        timer.add_items(1);
+        eval_result = get_board_eval_result(board);
     }
 
-    auto avg_parameters = static_cast<tune_t>(total_parameters) / entries.size();
-    cout << "Parameters total: " << parameters.size() << endl;
-    cout << "Parameters min: " << min_parameters << endl;
-    cout << "Parameters max: " << max_parameters << endl;
-    cout << "Parameters avg: " << avg_parameters << endl;
+    StageTimer timer(Stage::EntryBuild);
+    timer.add_items(1);
+    entry.white_to_move = board.sideToMove() == chess::Color::WHITE;
+    entry.stage_weights = Phase::get_weights(get_phase(board), eval_result.endgame_scale);
+    entry.coefficients.clear();
+    get_coefficient_entries(eval_result.coefficients, entry.coefficients);
+    finish_entry(parameters, eval_result.score, entry);
+}
 
-    cout << endl;
+// Same as build_entry, with the eval of the board at batch_index of a batched eval
+static void build_batch_entry(const chess::Board& board, const parameters_t& parameters, const EvalBatch& batch, const int32_t batch_index, Entry& entry)
+{
+    StageTimer timer(Stage::EntryBuild);
+    timer.add_items(1);
+    entry.white_to_move = board.sideToMove() == chess::Color::WHITE;
+    entry.stage_weights = Phase::get_weights(get_phase(board), batch.endgame_scales[batch_index]);
+    entry.coefficients.clear();
+    for (auto coefficient_index = batch.offsets[batch_index]; coefficient_index < batch.offsets[batch_index + 1]; coefficient_index++)
+    {
+        entry.coefficients.push_back(CoefficientEntry{ batch.values[coefficient_index], batch.indices[coefficient_index] });
+    }
+    finish_entry(parameters, batch.scores[batch_index], entry);
 }
 
 constexpr tune_t inf = 1 << 20;
+constexpr tune_t delta_margin = 200;
+static atomic<int64_t> qsearch_nodes = 0;
+
 struct PvEntry
 {
     array<chess::Move, 64> moves{};
@@ -337,52 +376,95 @@ static int32_t get_piece_value(const chess::Piece piece)
     }
 }
 
-static int32_t mvv_lva(const chess::Board& board, const chess::Move move)
+static chess::Piece get_captured_piece(const chess::Board& board, const chess::Move move)
 {
-    const auto from = move.from();
-    const auto to = move.to();
-    const auto piece = board.at(from);
-    chess::Piece takes;
-    const auto type = move.typeOf();
-    if(type == chess::Move::ENPASSANT)
+    if (move.typeOf() == chess::Move::ENPASSANT)
     {
-        takes = board.sideToMove() == chess::Color::WHITE ? chess::Piece::BLACKPAWN : chess::Piece::WHITEPAWN;
-    }
-    else
-    {
-        takes = board.at(to);
+        return board.sideToMove() == chess::Color::WHITE ? chess::Piece::BLACKPAWN : chess::Piece::WHITEPAWN;
     }
 
+    return board.at(move.to());
+}
+
+static int32_t mvv_lva(const chess::Board& board, const chess::Move move)
+{
+    const auto piece = board.at(move.from());
+    const auto takes = get_captured_piece(board, move);
+
     auto score = get_piece_value(takes);
     score <<= 16;
     score -= get_piece_value(piece);
     return score;
 }
 
-static tune_t quiescence(chess::Board& board, const parameters_t& parameters, pv_table_t& pv_table, tune_t alpha, tune_t beta, const int32_t ply)
+// Static exchange evaluation of a capture, using the same piece values as move ordering
+static int32_t see(const chess::Board& board, const chess::Move move)
 {
-    pv_table[ply].length = 0;
+    const auto to = move.to();
+    auto occupancy = board.occ();
+    array<int32_t, 32> gain{};
+    int32_t depth = 0;
 
-    EvalResult eval_result;
-    if constexpr (TuneEval::supports_external_chess_eval)
+    gain[0] = get_piece_value(get_captured_piece(board, move));
+    if (move.typeOf() == chess::Move::ENPASSANT)
     {
-        eval_result = TuneEval::get_external_eval_result(board);
+        occupancy ^= chess::Bitboard::fromSquare(to.ep_square());
     }
-    else
+
+    auto attacker_value = get_piece_value(board.at(move.from()));
+    occupancy ^= chess::Bitboard::fromSquare(move.from());
+    auto side = ~board.sideToMove();
+
+    while (depth < static_cast<int32_t>(gain.size()) - 1)
     {
-        auto fen = board.getFen();
-        eval_result = TuneEval::get_fen_eval_result(fen);
+        const auto attackers = chess::attacks::attackers(board, side, to, occupancy);
+        if (!attackers)
+        {
+            break;
+        }
+
+        depth++;
+        gain[depth] = attacker_value - gain[depth - 1];
+        if (max(-gain[depth - 1], gain[depth]) < 0)
+        {
+            break;
+        }
+
+        for (int32_t piece_type = 0; piece_type < 6; piece_type++)
+        {
+            const auto type = chess::PieceType(static_cast<chess::PieceType::underlying>(piece_type));
+            const auto type_attackers = attackers & board.pieces(type, side);
+            if (type_attackers)
+            {
+                occupancy ^= chess::Bitboard::fromSquare(type_attackers.lsb());
+                attacker_value = get_piece_value(chess::Piece(type, side));
+                break;
+            }
+        }
+
+        side = ~side;
+    }
+
+    while (depth > 0)
+    {
+        gain[depth - 1] = -max(-gain[depth - 1], gain[depth]);
+        depth--;
     }
 
+    return gain[0];
+}
+
+static tune_t quiescence(chess::Board& board, const parameters_t& parameters, pv_table_t& pv_table, int64_t& nodes, tune_t alpha, tune_t beta, const int32_t ply)
+{
+    pv_table[ply].length = 0;
+    nodes++;
+
+    const auto eval_result = get_board_eval_result(board);
+
     Entry entry;
     entry.white_to_move = board.sideToMove() == chess::Color::WHITE;
-#if TAPERED
-    entry.endgame_scale = eval_result.endgame_scale;
-#endif
-    get_coefficient_entries(eval_result.coefficients, entry.coefficients, static_cast<int32_t>(parameters.size()));
-#if TAPERED
-    entry.phase = get_phase(board);
-#endif
+    entry.stage_weights = Phase::get_weights(get_phase(board), eval_result.endgame_scale);
+    get_coefficient_entries(eval_result.coefficients, entry.coefficients);
     entry.additional_score = 0;
     tune_t eval = linear_eval(entry, parameters);
     if(!entry.white_to_move)
@@ -402,40 +484,51 @@ static tune_t quiescence(chess::Board& board, const parameters_t& parameters, pv
 
     chess::Movelist moves;
     chess::movegen::legalmoves<chess::movegen::MoveGenType::CAPTURE>(moves, board);
-    array<int32_t, 64> move_scores;
-    for (int32_t move_index = 0; move_index < moves.size(); move_index++)
-    {
-        move_scores[move_index] = mvv_lva(board, moves[move_index]);
-    }
 
-    if(moves.size() == 0)
+    struct ScoredMove
     {
-        return alpha;
-    }
-
-    tune_t best_score = -inf;
-    auto best_move = chess::Move(chess::Move::NO_MOVE);
-    //for (const auto& move : movelist) {
-    for(int32_t move_index = 0; move_index < moves.size(); move_index++)
+        int32_t score;
+        chess::Move move;
+    };
+    array<ScoredMove, 256> scored_moves;
+    int32_t scored_move_count = 0;
+    for (const auto& move : moves)
     {
-        int32_t best_move_score = 0;
-        int32_t best_move_index = 0;
-        for(auto i = move_index; i < moves.size(); i++)
+        if constexpr (enable_qsearch_pruning)
         {
-            if(move_scores[i] > best_move_score)
+            if (move.typeOf() != chess::Move::PROMOTION)
             {
-                best_move_score = move_scores[i];
-                best_move_index = i;
+                // Delta pruning, even winning the captured piece for free can't raise alpha
+                if (eval + get_piece_value(get_captured_piece(board, move)) + delta_margin <= alpha)
+                {
+                    continue;
+                }
+
+                if (see(board, move) < 0)
+                {
+                    continue;
+                }
             }
         }
 
-        const auto move = moves[best_move_index];
-        moves[best_move_index] = moves[move_index];
-        move_scores[best_move_index] = move_scores[move_index];
+        scored_moves[scored_move_count] = ScoredMove{ mvv_lva(board, move), move };
+        scored_move_count++;
+    }
+
+    sort(scored_moves.begin(), scored_moves.begin() + scored_move_count, [](const ScoredMove& left, const ScoredMove& right)
+    {
+        return left.score > right.score;
+    });
+
+    tune_t best_score = eval;
+    auto best_move = chess::Move(chess::Move::NO_MOVE);
+    for(int32_t move_index = 0; move_index < scored_move_count; move_index++)
+    {
+        const auto move = scored_moves[move_index].move;
 
         board.makeMove(move);
 
-        const auto child_score = -quiescence(board, parameters, pv_table, -beta, -alpha, ply + 1);
+        const auto child_score = -quiescence(board, parameters, pv_table, nodes, -beta, -alpha, ply + 1);
         if(child_score > best_score)
         {
             best_score = child_score;
@@ -466,27 +559,12 @@ static tune_t quiescence(chess::Board& board, const parameters_t& parameters, pv
     return best_score;
 }
 
-string cleanup_fen(const string& initial_fen)
-{
-    int space_count = 0;
-    size_t pos = 0;
-    for (size_t i = 0; i < initial_fen.size(); ++i) {
-        if (initial_fen[i] == ' ') {
-            ++space_count;
-        }
-        if (space_count == 4) {
-            pos = i;
-            break;
-        }
-    }
-    const auto clean_fen = initial_fen.substr(0, pos);
-    return clean_fen;
-}
-
 chess::Board quiescence_root(const parameters_t& parameters, chess::Board board)
 {
     pv_table_t pv_table {};
-    auto score = quiescence(board, parameters, pv_table, -inf, inf, 0);
+    int64_t nodes = 0;
+    auto score = quiescence(board, parameters, pv_table, nodes, -inf, inf, 0);
+    qsearch_nodes.fetch_add(nodes, memory_order_relaxed);
     if(board.sideToMove() == chess::Color::BLACK)
     {
         score = -score;
@@ -512,308 +590,2134 @@ chess::Board quiescence_root(const parameters_t& parameters, chess::Board board)
     return board;
 }
 
-static void parse_fen(const bool side_to_move_wdl, const parameters_t& parameters, vector<Entry>& entries, const string& original_fen)
+// Filters the board and replaces it with its quiescence leaf, which the entry is then built from
+static bool prepare_board(const parameters_t& parameters, chess::Board& board, QuiescenceSource& qsearch_source)
 {
-    if constexpr (print_data_entries)
+    if constexpr (TuneEval::filter_in_check)
     {
-        cout << original_fen;
+        if (board.inCheck())
+            return false;
     }
 
-    //string fen;
-    const auto clean_fen = cleanup_fen(original_fen);
-    chess::Board board = chess::Board(clean_fen);
-
-    if constexpr (TuneEval::filter_in_check)
+    if constexpr (refresh_qsearch)
     {
-        if (board.inCheck())
-            return;
+        qsearch_source.board = pack_board(board);
     }
 
     if constexpr (TuneEval::enable_qsearch)
     {
+        StageTimer timer(Stage::Qsearch);
+        timer.add_items(1);
         board = quiescence_root(parameters, board);
     }
 
-    EvalResult eval_result;
-    if constexpr (TuneEval::supports_external_chess_eval)
+    if constexpr (refresh_qsearch)
     {
-        eval_result = TuneEval::get_external_eval_result(board);
+        qsearch_source.leaf_hash = board.hash();
     }
-    else
+
+    return true;
+}
+
+static bool parse_board(const parameters_t& parameters, chess::Board& board, const tune_t wdl, Entry& entry, QuiescenceSource& qsearch_source)
+{
+    if (!prepare_board(parameters, board, qsearch_source))
     {
-        auto fen = board.getFen();
-        eval_result = TuneEval::get_fen_eval_result(fen);
+        return false;
     }
 
-    Entry entry;
-    //entry.white_to_move = get_fen_color_to_move(fen);
-    entry.white_to_move = board.sideToMove() == chess::Color::WHITE;
-#if TAPERED
-    entry.endgame_scale = eval_result.endgame_scale;
-#endif
-    const bool original_white_to_move = get_fen_color_to_move(original_fen);
-    //cout << (entry.white_to_move ? "w" : "b") << " ";
-    entry.wdl = get_fen_wdl(original_fen, original_white_to_move, entry.white_to_move, side_to_move_wdl);
-    get_coefficient_entries(eval_result.coefficients, entry.coefficients, static_cast<int32_t>(parameters.size()));
-#if TAPERED
-    entry.phase = get_phase(board);
-#endif
-    entry.additional_score = 0;
-    if constexpr (TuneEval::includes_additional_score)
+    entry.wdl = wdl;
+    build_entry(board, parameters, entry);
+    return true;
+}
+
+class MemoryStreamBuffer : public streambuf
+{
+public:
+    MemoryStreamBuffer(char* begin, char* end)
     {
-        const tune_t score = linear_eval(entry, parameters);
-        if constexpr (print_data_entries)
-        {
-            cout << " Eval: " << score << endl;
-        }
-        entry.additional_score = eval_result.score - score;
+        setg(begin, begin, end);
     }
+};
 
-    entries.push_back(entry);
-}
+#pragma pack(push, 1)
+struct StreamedEntryHeader
+{
+    tune_t wdl;
+    tune_t weight;
+    tune_t additional_score;
+    [[no_unique_address]] Phase::weights_t stage_weights;
+    uint16_t coefficient_count;
+    bool white_to_move;
+};
+#pragma pack(pop)
 
-static void read_fens(const DataSource& source, const high_resolution_clock::time_point start, vector<string>& fens)
+// Entries kept on disk in shard files, for datasets which don't fit in memory. Shards are
+// appended to while loading, and each pass reads the next shard while the current one is processed.
+class EntryStream
 {
-    cout << "Reading " << source.path;
-    if (source.position_limit > 0)
+public:
+    explicit EntryStream(const string& directory) : directory(directory)
     {
-        cout << " (" << source.position_limit << " positions)";
+        filesystem::create_directories(directory);
     }
-    cout << "..." << endl;
 
-    ifstream file(source.path);
-    if (!file)
+    ~EntryStream()
     {
-        cout << "Failed to open " << source.path << endl;
-        throw runtime_error("Failed to open data source");
+        for (const auto& path : shard_paths)
+        {
+            error_code error;
+            filesystem::remove(path, error);
+        }
     }
 
-    while (!file.eof())
+    // Thread safe, the entries of one call always end up in the same shard
+    void write(const vector<Entry>& entries)
     {
-        if (source.position_limit > 0 && fens.size() >= source.position_limit)
+        string bytes;
+        double weight = 0;
+        for (const auto& entry : entries)
         {
-            break;
+            StreamedEntryHeader header;
+            header.wdl = entry.wdl;
+            header.weight = entry.weight;
+            header.additional_score = entry.additional_score;
+            header.stage_weights = entry.stage_weights;
+            header.coefficient_count = static_cast<uint16_t>(entry.coefficients.size());
+            header.white_to_move = entry.white_to_move;
+            bytes.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            bytes.append(reinterpret_cast<const char*>(entry.coefficients.data()), entry.coefficients.size() * sizeof(CoefficientEntry));
+            weight += entry.weight;
         }
 
-        string original_fen;
-        getline(file, original_fen);
-        if (original_fen.empty())
+        lock_guard lock(mut);
+        if (!shard_file.is_open() || shard_bytes >= stream_shard_size)
         {
-            break;
+            start_shard();
+        }
+        shard_file.write(bytes.data(), bytes.size());
+        if (!shard_file)
+        {
+            throw runtime_error("Failed to write entry shard");
         }
+        shard_bytes += bytes.size();
+        entry_count += entries.size();
+        total_weight += weight;
+    }
 
-        fens.push_back(original_fen);
+    void finish()
+    {
+        shard_file.close();
     }
 
-    print_elapsed(start);
-    std::cout << "Read " << fens.size() << " positions from " << source.path << endl;
-}
+    size_t size() const
+    {
+        return entry_count;
+    }
 
-static void parse_fens(ThreadPool& thread_pool, const DataSource& source, const vector<string>& fens, const parameters_t& parameters, const high_resolution_clock::time_point time_start, vector<Entry>& entries)
-{
-    cout << "Parsing " << fens.size() << " positions..." << endl;
-    array<vector<Entry>, data_load_thread_count> thread_entries;
-    const auto side_to_move_wdl = source.side_to_move_wdl;
-    constexpr int batch_size = 10000;
-    mutex mut;
-    queue<vector<string>> batches;
-    vector<string> current_batch;
-    for(const auto& fen : fens)
+    tune_t get_total_weight() const
+    {
+        return static_cast<tune_t>(total_weight);
+    }
+
+    void for_each_shard(const function<void(const vector<Entry>&)>& process)
     {
-        current_batch.push_back(fen);
-        if (current_batch.size() == batch_size)
+        if (shard_paths.empty())
+        {
+            return;
+        }
+
+        auto prefetch = async(launch::async, &EntryStream::read_shard, shard_paths[0], ref(buffers[0]));
+        for (size_t shard_index = 0; shard_index < shard_paths.size(); shard_index++)
         {
-            batches.emplace(current_batch);
-            current_batch.clear();
+            prefetch.get();
+            if (shard_index + 1 < shard_paths.size())
+            {
+                prefetch = async(launch::async, &EntryStream::read_shard, shard_paths[shard_index + 1], ref(buffers[(shard_index + 1) % 2]));
+            }
+            process(buffers[shard_index % 2]);
         }
     }
-    if(!current_batch.empty())
+
+private:
+    void start_shard()
     {
-        batches.emplace(current_batch);
+        shard_file.close();
+        shard_paths.push_back(directory + "/shard_" + to_string(shard_paths.size()) + ".bin");
+        shard_file.open(shard_paths.back(), ios::binary | ios::trunc);
+        if (!shard_file)
+        {
+            cout << "Failed to create " << shard_paths.back() << endl;
+            throw runtime_error("Failed to create entry shard");
+        }
+        shard_bytes = 0;
     }
 
-    for (int thread_id = 0; thread_id < data_load_thread_count; thread_id++)
+    // Decodes into the existing entries, so that their coefficient vectors are reused between shards
+    static void read_shard(const string& path, vector<Entry>& entries)
     {
-        thread_pool.enqueue([thread_id, &thread_entries, &mut, side_to_move_wdl, parameters, &batches, time_start]()
+        ifstream file(path, ios::binary | ios::ate);
+        string bytes(static_cast<size_t>(file.tellg()), '\0');
+        file.seekg(0);
+        file.read(bytes.data(), bytes.size());
+        if (!file)
         {
-            vector<Entry> entries;
+            throw runtime_error("Failed to read entry shard");
+        }
 
-            int position_count = 0;
-            while(true)
+        size_t entry_count = 0;
+        size_t position = 0;
+        while (position + sizeof(StreamedEntryHeader) <= bytes.size())
+        {
+            StreamedEntryHeader header;
+            memcpy(&header, bytes.data() + position, sizeof(header));
+            position += sizeof(header);
+
+            if (entry_count == entries.size())
+            {
+                entries.emplace_back();
+            }
+            auto& entry = entries[entry_count++];
+            entry.wdl = header.wdl;
+            entry.weight = header.weight;
+            entry.additional_score = header.additional_score;
+            entry.stage_weights = header.stage_weights;
+            entry.white_to_move = header.white_to_move;
+            entry.coefficients.resize(header.coefficient_count);
+            memcpy(entry.coefficients.data(), bytes.data() + position, header.coefficient_count * sizeof(CoefficientEntry));
+            position += header.coefficient_count * sizeof(CoefficientEntry);
+        }
+        entries.resize(entry_count);
+    }
+
+    string directory;
+    mutex mut;
+    ofstream shard_file;
+    int64_t shard_bytes = 0;
+    vector<string> shard_paths;
+    size_t entry_count = 0;
+    double total_weight = 0;
+    array<vector<Entry>, 2> buffers;
+};
+
+// Calls process with all entries at once, or shard by shard when they are streamed from disk
+static void for_each_entry_shard(const vector<Entry>& entries, EntryStream* stream, const function<void(const vector<Entry>&)>& process)
+{
+    if (stream)
+    {
+        stream->for_each_shard(process);
+    }
+    else
+    {
+        process(entries);
+    }
+}
+
+struct LoadBlock
+{
+    // File offset of the first byte or record of the block
+    int64_t offset = 0;
+    // Whole EPD lines or whole PGN games for text data sources
+    string text;
+    vector<PackedBoard> boards;
+    vector<Entry> entries;
+    vector<QuiescenceSource> qsearch_sources;
+    // Source position hashes of the entries, only kept when deduplicating
+    vector<uint64_t> position_hashes;
+    int64_t position_count = 0;
+    int64_t streamed_count = 0;
+    int64_t duplicate_count = 0;
+    int64_t skipped_games = 0;
+};
+
+struct SampledPosition
+{
+    uint64_t key;
+    uint64_t position_hash;
+    Entry entry;
+    QuiescenceSource qsearch_source;
+};
+
+// Concurrent set of the positions seen so far, which accumulates the WDL of every occurrence
+class DuplicateTable
+{
+public:
+    // Returns true for the first occurrence of a position in a data source, which is the one that becomes an entry
+    // of the source. Every source keeps its own copy so that its sampling doesn't depend on the order in which the
+    // sources are read, the copies of the sampled positions are merged after loading.
+    bool add(const uint64_t position_hash, const tune_t wdl, const int32_t source_index)
+    {
+        auto& shard = shards[position_hash >> (64 - shard_bits)];
+        lock_guard lock(shard.mut);
+        auto& stats = shard.positions[position_hash];
+        stats.wdl_sum += wdl;
+        stats.squared_wdl_sum += static_cast<double>(wdl) * wdl;
+        stats.count++;
+        return shard.source_positions.insert(SourcePosition{ position_hash, source_index }).second;
+    }
+
+    // Returns the squared deviation of the occurrences' WDLs from their mean, which the merged entry no longer holds
+    double apply(Entry& entry, const uint64_t position_hash) const
+    {
+        const auto& shard = shards[position_hash >> (64 - shard_bits)];
+        const auto& stats = shard.positions.at(position_hash);
+        const auto mean_wdl = stats.wdl_sum / stats.count;
+        entry.wdl = static_cast<tune_t>(mean_wdl);
+        entry.weight = static_cast<tune_t>(stats.count);
+        return max(stats.squared_wdl_sum - mean_wdl * stats.wdl_sum, 0.0);
+    }
+
+private:
+    struct PositionStats
+    {
+        double wdl_sum = 0;
+        double squared_wdl_sum = 0;
+        int64_t count = 0;
+    };
+
+    struct SourcePosition
+    {
+        uint64_t position_hash;
+        int32_t source_index;
+
+        bool operator==(const SourcePosition&) const = default;
+    };
+
+    struct SourcePositionHash
+    {
+        size_t operator()(const SourcePosition& position) const
+        {
+            return position.position_hash ^ (static_cast<uint64_t>(position.source_index) * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    struct Shard
+    {
+        mutex mut;
+        unordered_map<uint64_t, PositionStats> positions;
+        unordered_set<SourcePosition, SourcePositionHash> source_positions;
+    };
+
+    constexpr static int32_t shard_bits = 6;
+    array<Shard, 1 << shard_bits> shards;
+};
+
+// Keeps the positions with the smallest random keys in each stratum. This is a uniform sample
+// of everything offered to it, regardless of the order in which the positions arrive.
+class PositionSampler
+{
+public:
+    // Every stratum keeps its even share of the limit plus a reserve, so that strata with too few
+    // positions for their share can be topped up from the others when collecting
+    PositionSampler(const int64_t capacity, const int32_t stratum_count)
+        : total_capacity(capacity), stratum_count(stratum_count)
+    {
+        const auto share = (capacity + stratum_count - 1) / stratum_count;
+        const auto reserve = stratum_count > 1 ? static_cast<int64_t>(ceil(share * sampling_stratum_reserve)) : 0;
+        for (int32_t stratum = 0; stratum < stratum_count; stratum++)
+        {
+            strata[stratum].capacity = static_cast<size_t>(min(share + reserve, capacity));
+        }
+    }
+
+    // Cheap pre-check, so that positions which can't make it into the sample don't have to be parsed
+    bool accepts(const uint64_t key, const int32_t stratum) const
+    {
+        return key < strata[stratum].threshold.load(memory_order_relaxed);
+    }
+
+    void offer(SampledPosition&& position, const int32_t stratum)
+    {
+        auto& sampled = strata[stratum];
+        lock_guard lock(mut);
+        if (sampled.positions.size() < sampled.capacity)
+        {
+            sampled.positions.push_back(std::move(position));
+            push_heap(sampled.positions.begin(), sampled.positions.end(), compare_keys);
+        }
+        else if (!sampled.positions.empty() && position.key < sampled.positions.front().key)
+        {
+            pop_heap(sampled.positions.begin(), sampled.positions.end(), compare_keys);
+            sampled.positions.back() = std::move(position);
+            push_heap(sampled.positions.begin(), sampled.positions.end(), compare_keys);
+        }
+
+        if (sampled.positions.size() == sampled.capacity)
+        {
+            sampled.threshold = sampled.capacity == 0 ? 0 : sampled.positions.front().key;
+        }
+    }
+
+    int64_t collect(vector<Entry>& entries, vector<QuiescenceSource>& qsearch_sources, vector<uint64_t>& position_hashes)
+    {
+        // The limit is split evenly, the share a stratum can't fill goes to the reserves of the strata which still have positions
+        array<int32_t, phase_bucket_count> order{};
+        for (int32_t stratum = 0; stratum < stratum_count; stratum++)
+        {
+            order[stratum] = stratum;
+        }
+        stable_sort(order.begin(), order.begin() + stratum_count, [this](const int32_t left, const int32_t right)
+        {
+            return strata[left].positions.size() < strata[right].positions.size();
+        });
+
+        array<size_t, phase_bucket_count> shares{};
+        auto remaining = static_cast<size_t>(total_capacity);
+        for (int32_t order_index = 0; order_index < stratum_count; order_index++)
+        {
+            const auto stratum = order[order_index];
+            const auto stratum_left = static_cast<size_t>(stratum_count - order_index);
+            const auto share = min(strata[stratum].positions.size(), (remaining + stratum_left - 1) / stratum_left);
+            shares[stratum] = share;
+            remaining -= share;
+        }
+
+        int64_t count = 0;
+        for (int32_t stratum = 0; stratum < stratum_count; stratum++)
+        {
+            auto& sampled = strata[stratum];
+            // The lowest keys of a stratum are a uniform sample of it
+            sort(sampled.positions.begin(), sampled.positions.end(), compare_keys);
+            sampled.positions.resize(shares[stratum]);
+            for (auto& position : sampled.positions)
+            {
+                entries.push_back(std::move(position.entry));
+                if constexpr (refresh_qsearch)
+                {
+                    qsearch_sources.push_back(position.qsearch_source);
+                }
+                if constexpr (deduplicate_positions)
+                {
+                    position_hashes.push_back(position.position_hash);
+                }
+            }
+            count += sampled.positions.size();
+            sampled.positions.clear();
+        }
+        return count;
+    }
+
+private:
+    struct Stratum
+    {
+        size_t capacity = 0;
+        vector<SampledPosition> positions;
+        atomic<uint64_t> threshold = numeric_limits<uint64_t>::max();
+    };
+
+    static bool compare_keys(const SampledPosition& left, const SampledPosition& right)
+    {
+        return left.key < right.key;
+    }
+
+    int64_t total_capacity;
+    int32_t stratum_count;
+    mutex mut;
+    array<Stratum, phase_bucket_count> strata;
+};
+
+struct SourceLoadState
+{
+    const DataSource* source = nullptr;
+    int32_t source_index = 0;
+    // Positions taken from the source so far, shared by all of its ranges to enforce the position limit
+    atomic<int64_t> position_count = 0;
+    // Only set when the position limit is filled by sampling instead of taking the first positions
+    unique_ptr<PositionSampler> sampler;
+    // Shared by all data sources
+    DuplicateTable* duplicates = nullptr;
+};
+
+static bool has_position_budget(const SourceLoadState& state)
+{
+    return state.source->position_limit > 0 && !state.sampler;
+}
+
+// Takes up to count positions from the source's position limit, returns how many may be used
+static int64_t claim_positions(SourceLoadState& state, const int64_t count)
+{
+    if (!has_position_budget(state))
+    {
+        return count;
+    }
+
+    const auto claimed = state.position_count.fetch_add(count);
+    return clamp<int64_t>(state.source->position_limit - claimed, 0, count);
+}
+
+static bool is_source_limit_reached(const SourceLoadState& state)
+{
+    return has_position_budget(state) && state.position_count >= state.source->position_limit;
+}
+
+static int32_t get_sampling_stratum_count()
+{
+    switch (position_sampling)
+    {
+    case PositionSampling::PhaseStratified:
+        return phase_bucket_count;
+    case PositionSampling::ResultStratified:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+static int32_t get_sampling_stratum(const chess::Board& board, const tune_t wdl)
+{
+    switch (position_sampling)
+    {
+    case PositionSampling::PhaseStratified:
+        return min(get_phase(board), 24) * phase_bucket_count / 25;
+    case PositionSampling::ResultStratified:
+        return wdl < 0.25 ? 0 : (wdl < 0.75 ? 1 : 2);
+    default:
+        return 0;
+    }
+}
+
+// splitmix64 of the seed and the position's location in the file, independent of thread scheduling
+static uint64_t get_sampling_key(const int64_t offset, const uint64_t index)
+{
+    const auto mix = [](uint64_t value)
+    {
+        value += 0x9E3779B97F4A7C15ULL;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+        return value ^ (value >> 31);
+    };
+
+    return mix(mix(position_sampling_seed ^ static_cast<uint64_t>(offset)) + index);
+}
+
+// Positions of the block being parsed which wait for a batched eval. One per parse thread, so that the
+// boards and the eval batch keep their allocations from block to block.
+struct PendingEvalBatch
+{
+    vector<chess::Board> boards;
+    vector<SampledPosition> positions;
+    vector<int32_t> strata;
+    int32_t size = 0;
+    EvalBatch batch;
+};
+
+static thread_local PendingEvalBatch pending_eval_batch;
+
+static void add_block_position(SourceLoadState& state, LoadBlock& block, SampledPosition&& position, const int32_t stratum)
+{
+    if (state.sampler)
+    {
+        state.sampler->offer(std::move(position), stratum);
+        return;
+    }
+
+    block.entries.push_back(std::move(position.entry));
+    if constexpr (refresh_qsearch)
+    {
+        block.qsearch_sources.push_back(position.qsearch_source);
+    }
+    if constexpr (deduplicate_positions)
+    {
+        block.position_hashes.push_back(position.position_hash);
+    }
+}
+
+// Evaluates the pending positions in one batch and adds them to the block they were parsed from
+template<typename Eval = TuneEval>
+static void flush_eval_batch(const parameters_t& parameters, SourceLoadState& state, LoadBlock& block)
+{
+    auto& pending = pending_eval_batch;
+    if (pending.size == 0)
+    {
+        return;
+    }
+
+    TraceSpan batch_span("eval_batch");
+    pending.batch.clear(parameter_count);
+    {
+        StageTimer timer(Stage::Trace);
+        timer.add_items(pending.size);
+        Eval::get_external_eval_results(span<const chess::Board>(pending.boards.data(), pending.size), pending.batch);
+    }
+    if (pending.batch.size() != pending.size)
+    {
+        throw runtime_error("Batched eval returned a different number of positions");
+    }
+
+    for (int32_t batch_index = 0; batch_index < pending.size; batch_index++)
+    {
+        auto& position = pending.positions[batch_index];
+        build_batch_entry(pending.boards[batch_index], parameters, pending.batch, batch_index, position.entry);
+        add_block_position(state, block, std::move(position), pending.strata[batch_index]);
+    }
+    pending.size = 0;
+}
+
+// Parses a board into an entry of the block, or offers it to the sampler of the source. Sources which can't
+// claim their positions up front, like PGN, pass claim_position to claim it only once it is accepted.
+static void add_block_board(const parameters_t& parameters, SourceLoadState& state, LoadBlock& block, chess::Board& board, const tune_t wdl, uint64_t sampling_key, const bool claim_position)
+{
+    block.position_count++;
+
+    uint64_t position_hash = 0;
+    if constexpr (deduplicate_positions)
+    {
+        // Later occurrences only contribute their WDL to the entry of the first one
+        position_hash = board.hash();
+        if (!state.duplicates->add(position_hash, wdl, state.source_index))
+        {
+            block.duplicate_count++;
+            return;
+        }
+
+        // Whichever occurrence comes first, the position is sampled the same way
+        sampling_key = get_sampling_key(static_cast<int64_t>(position_hash), 0);
+    }
+
+    int32_t stratum = 0;
+    if (state.sampler)
+    {
+        stratum = get_sampling_stratum(board, wdl);
+        if (!state.sampler->accepts(sampling_key, stratum))
+        {
+            return;
+        }
+    }
+
+    SampledPosition position;
+    position.key = sampling_key;
+    position.position_hash = position_hash;
+    if constexpr (use_batch_eval)
+    {
+        if (!prepare_board(parameters, board, position.qsearch_source))
+        {
+            return;
+        }
+
+        if (claim_position && claim_positions(state, 1) == 0)
+        {
+            return;
+        }
+
+        auto& pending = pending_eval_batch;
+        if (pending.size == static_cast<int32_t>(pending.boards.size()))
+        {
+            pending.boards.emplace_back();
+            pending.positions.emplace_back();
+            pending.strata.emplace_back();
+        }
+
+        position.entry.wdl = wdl;
+        pending.boards[pending.size] = board;
+        pending.positions[pending.size] = std::move(position);
+        pending.strata[pending.size] = stratum;
+        pending.size++;
+        if (pending.size == eval_batch_size)
+        {
+            flush_eval_batch(parameters, state, block);
+        }
+        return;
+    }
+
+    if (!parse_board(parameters, board, wdl, position.entry, position.qsearch_source))
+    {
+        return;
+    }
+
+    if (claim_position && claim_positions(state, 1) == 0)
+    {
+        return;
+    }
+
+    add_block_position(state, block, std::move(position), stratum);
+}
+
+static void parse_fen(const parameters_t& parameters, chess::Board& board, SourceLoadState& state, LoadBlock& block, const string_view original_fen, const int64_t offset)
+{
+    if constexpr (print_data_entries)
+    {
+        cout << original_fen;
+    }
+
+    const auto line = parse_fen_line(original_fen, state.source->side_to_move_wdl);
+    board.setFen(line.fen);
+    add_block_board(parameters, state, block, board, line.wdl, get_sampling_key(offset, 0), false);
+}
+
+// Byte range of a data source, starting at the beginning of a line, game or record
+struct RangeLoadState
+{
+    SourceLoadState* source_state = nullptr;
+    int64_t begin = 0;
+    int64_t end = 0;
+    // Blocks are only appended by the single reader of the range, deque keeps references stable for the parse workers
+    deque<LoadBlock> blocks;
+};
+
+struct BlockJob
+{
+    SourceLoadState* state;
+    LoadBlock* block;
+};
+
+// Bounded queue between the data source readers and the parse workers
+class BlockQueue
+{
+public:
+    BlockQueue(const size_t capacity, const int32_t producer_count)
+        : capacity(capacity), producer_count(producer_count)
+    {
+    }
+
+    void push(const BlockJob& job)
+    {
+        {
+            unique_lock lock(mut);
+            not_full.wait(lock, [this] { return jobs.size() < capacity; });
+            jobs.push(job);
+        }
+        not_empty.notify_one();
+    }
+
+    bool pop(BlockJob& job)
+    {
+        {
+            unique_lock lock(mut);
+            not_empty.wait(lock, [this] { return !jobs.empty() || producer_count == 0; });
+            if (jobs.empty())
+            {
+                return false;
+            }
+
+            job = jobs.front();
+            jobs.pop();
+        }
+        not_full.notify_one();
+        return true;
+    }
+
+    void producer_done()
+    {
+        {
+            lock_guard lock(mut);
+            producer_count--;
+        }
+        not_empty.notify_all();
+    }
+
+private:
+    mutex mut;
+    condition_variable not_full;
+    condition_variable not_empty;
+    queue<BlockJob> jobs;
+    const size_t capacity;
+    int32_t producer_count;
+};
+
+// Replays each game and turns the sampled positions directly into entries,
+// labelled with the game result from white's point of view
+class PgnEntryVisitor : public chess::pgn::Visitor
+{
+public:
+    PgnEntryVisitor(const parameters_t& parameters, SourceLoadState& state, LoadBlock& block)
+        : parameters(parameters), state(state), block(block)
+    {
+    }
+
+    void startPgn() override
+    {
+        fen.clear();
+        wdl = -1;
+        ply = 0;
+        game_index++;
+    }
+
+    void header(const string_view key, const string_view value) override
+    {
+        if (key == "FEN")
+        {
+            fen = value;
+        }
+        else if (key == "Result")
+        {
+            if (value == "1-0")
+            {
+                wdl = 1;
+            }
+            else if (value == "1/2-1/2")
+            {
+                wdl = 0.5;
+            }
+            else if (value == "0-1")
+            {
+                wdl = 0;
+            }
+        }
+    }
+
+    void startMoves() override
+    {
+        if (is_source_limit_reached(state))
+        {
+            skipPgn(true);
+            return;
+        }
+
+        if (wdl < 0)
+        {
+            skip_game();
+            return;
+        }
+
+        board.setFen(fen.empty() ? chess::constants::STARTPOS : string_view(fen));
+    }
+
+    void move(const string_view san, const string_view comment) override
+    {
+        chess::Move move;
+        try
+        {
+            move = chess::uci::parseSan(board, san, moves);
+        }
+        catch (const exception&)
+        {
+            skip_game();
+            return;
+        }
+
+        if (should_sample(move, comment))
+        {
+            // The copy is searched and evaluated, packing it leaves the game's move history behind
+            sample.unpack(pack_board(board));
+            add_block_board(parameters, state, block, sample, wdl, get_sampling_key(block.offset, (game_index << 16) | ply), true);
+            if (is_source_limit_reached(state))
+            {
+                skipPgn(true);
+                return;
+            }
+        }
+
+        board.makeMove(move);
+        ply++;
+    }
+
+    void endPgn() override
+    {
+    }
+
+    int64_t skipped_games() const
+    {
+        return skipped_game_count;
+    }
+
+private:
+    const parameters_t& parameters;
+    SourceLoadState& state;
+    LoadBlock& block;
+
+    chess::Board board;
+    UnpackedBoard sample;
+    chess::Movelist moves;
+    string fen;
+    tune_t wdl = -1;
+    int32_t ply = 0;
+    uint64_t game_index = 0;
+    int64_t skipped_game_count = 0;
+
+    void skip_game()
+    {
+        skipped_game_count++;
+        skipPgn(true);
+    }
+
+    bool should_sample(const chess::Move move, const string_view comment) const
+    {
+        if (ply < pgn_min_ply || (pgn_max_ply > 0 && ply > pgn_max_ply))
+        {
+            return false;
+        }
+
+        if ((ply - pgn_min_ply) % pgn_sample_interval != 0)
+        {
+            return false;
+        }
+
+        if constexpr (pgn_skip_book)
+        {
+            if (comment.find("book") != string_view::npos)
+            {
+                return false;
+            }
+        }
+
+        if constexpr (pgn_skip_noisy)
+        {
+            if (board.isCapture(move) || move.typeOf() == chess::Move::PROMOTION || board.inCheck())
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+static void parse_pgn_block(const parameters_t& parameters, SourceLoadState& state, LoadBlock& block)
+{
+    MemoryStreamBuffer buffer(block.text.data(), block.text.data() + block.text.size());
+    istream stream(&buffer);
+    // The parser holds a large read buffer, so keep it off the stack
+    auto parser = make_unique<chess::pgn::StreamParser>(stream);
+    PgnEntryVisitor visitor(parameters, state, block);
+    parser->readGames(visitor);
+    block.skipped_games = visitor.skipped_games();
+
+    block.text.clear();
+    block.text.shrink_to_fit();
+}
+
+static size_t find_last_game_start(const string& text)
+{
+    for (const auto separator : { "\n\n[", "\n\r\n[" })
+    {
+        const auto position = text.rfind(separator);
+        if (position != string::npos)
+        {
+            return position + string_view(separator).size() - 1;
+        }
+    }
+
+    return string::npos;
+}
+
+static void parse_epd_block(const parameters_t& parameters, SourceLoadState& state, chess::Board& board, LoadBlock& block)
+{
+    const string_view text = block.text;
+    size_t line_start = 0;
+    while (line_start < text.size())
+    {
+        auto line_end = text.find('\n', line_start);
+        if (line_end == string_view::npos)
+        {
+            line_end = text.size();
+        }
+
+        auto line = text.substr(line_start, line_end - line_start);
+        if (line.ends_with('\r'))
+        {
+            line.remove_suffix(1);
+        }
+        if (!line.empty())
+        {
+            parse_fen(parameters, board, state, block, line, block.offset + static_cast<int64_t>(line_start));
+        }
+
+        line_start = line_end + 1;
+    }
+
+    block.text.clear();
+    block.text.shrink_to_fit();
+}
+
+static void parse_packed_block(const parameters_t& parameters, SourceLoadState& state, UnpackedBoard& board, LoadBlock& block)
+{
+    for (size_t board_index = 0; board_index < block.boards.size(); board_index++)
+    {
+        const auto& packed = block.boards[board_index];
+        board.unpack(packed);
+        const auto wdl = static_cast<tune_t>(packed.result) / packed_result_scale;
+        add_block_board(parameters, state, block, board, wdl, get_sampling_key(block.offset, board_index), false);
+    }
+
+    block.boards.clear();
+    block.boards.shrink_to_fit();
+}
+
+constexpr size_t text_block_size = 4 << 20;
+
+constexpr int64_t min_range_size = 64 << 20;
+
+static void read_range_text(ifstream& file, int64_t& offset, const int64_t end, string& text)
+{
+    StageTimer timer(Stage::Read);
+    const auto read_size = min<int64_t>(text_block_size, end - offset);
+    const auto previous_size = text.size();
+    text.resize(previous_size + read_size);
+    file.read(text.data() + previous_size, read_size);
+    text.resize(previous_size + file.gcount());
+    offset += file.gcount();
+    timer.add_items(file.gcount());
+}
+
+static void read_epd_range(RangeLoadState& range, BlockQueue& queue)
+{
+    auto& state = *range.source_state;
+    ifstream file(state.source->path, ios::binary);
+    file.seekg(range.begin);
+    auto offset = range.begin;
+    string carry;
+
+    while (file && offset < range.end && !is_source_limit_reached(state))
+    {
+        string text = move(carry);
+        carry.clear();
+        read_range_text(file, offset, range.end, text);
+        const auto text_offset = offset - static_cast<int64_t>(text.size());
+
+        // Only whole lines are handed to workers, the rest is carried into the next block
+        if (file && offset < range.end)
+        {
+            const auto last_line_end = text.rfind('\n');
+            if (last_line_end == string::npos)
+            {
+                carry = move(text);
+                continue;
+            }
+
+            carry = text.substr(last_line_end + 1);
+            text.resize(last_line_end + 1);
+        }
+
+        if (has_position_budget(state))
+        {
+            int64_t block_line_count = 0;
+            for (size_t i = 0; i < text.size(); i++)
+            {
+                if (text[i] == '\n' || i == text.size() - 1)
+                {
+                    block_line_count++;
+                }
+            }
+
+            const auto allowed = claim_positions(state, block_line_count);
+            if (allowed < block_line_count)
+            {
+                int64_t line_count = 0;
+                for (size_t i = 0; i < text.size() && line_count < allowed; i++)
+                {
+                    if (text[i] == '\n')
+                    {
+                        line_count++;
+                        if (line_count == allowed)
+                        {
+                            text.resize(i + 1);
+                        }
+                    }
+                }
+                if (allowed == 0)
+                {
+                    text.clear();
+                }
+            }
+        }
+
+        if (text.empty())
+        {
+            continue;
+        }
+
+        auto& block = range.blocks.emplace_back();
+        block.offset = text_offset;
+        block.text = move(text);
+        queue.push(BlockJob{ &state, &block });
+    }
+}
+
+static void read_pgn_range(RangeLoadState& range, BlockQueue& queue)
+{
+    auto& state = *range.source_state;
+    ifstream file(state.source->path, ios::binary);
+    file.seekg(range.begin);
+    auto offset = range.begin;
+    string carry;
+
+    while (file && offset < range.end && !is_source_limit_reached(state))
+    {
+        string text = move(carry);
+        carry.clear();
+        read_range_text(file, offset, range.end, text);
+        const auto text_offset = offset - static_cast<int64_t>(text.size());
+
+        // Only whole games are handed to workers, the rest is carried into the next block
+        if (file && offset < range.end)
+        {
+            const auto game_start = find_last_game_start(text);
+            if (game_start == string::npos || game_start == 0)
+            {
+                carry = move(text);
+                continue;
+            }
+
+            carry = text.substr(game_start);
+            text.resize(game_start);
+        }
+
+        auto& block = range.blocks.emplace_back();
+        block.offset = text_offset;
+        block.text = move(text);
+        queue.push(BlockJob{ &state, &block });
+    }
+}
+
+static void read_packed_range(RangeLoadState& range, BlockQueue& queue)
+{
+    auto& state = *range.source_state;
+    ifstream file(state.source->path, ios::binary);
+    file.seekg(range.begin);
+    constexpr int64_t block_size = 1 << 16;
+    auto offset = range.begin;
+
+    while (file && offset < range.end && !is_source_limit_reached(state))
+    {
+        const auto read_count = min<int64_t>(block_size, (range.end - offset) / sizeof(PackedBoard));
+        if (read_count <= 0)
+        {
+            break;
+        }
+
+        vector<PackedBoard> boards(read_count);
+        {
+            StageTimer timer(Stage::Read);
+            file.read(reinterpret_cast<char*>(boards.data()), read_count * sizeof(PackedBoard));
+            timer.add_items(file.gcount());
+        }
+        const auto block_offset = offset;
+        offset += file.gcount();
+
+        // Only whole records which were read take from the budget, the rest is left to the other ranges of the source
+        boards.resize(claim_positions(state, file.gcount() / sizeof(PackedBoard)));
+        if (boards.empty())
+        {
+            break;
+        }
+
+        auto& block = range.blocks.emplace_back();
+        block.offset = block_offset;
+        block.boards = move(boards);
+        queue.push(BlockJob{ &state, &block });
+    }
+}
+
+static void read_range(RangeLoadState& range, BlockQueue& queue)
+{
+    switch (range.source_state->source->format)
+    {
+    case DataSourceFormat::Epd:
+        read_epd_range(range, queue);
+        break;
+    case DataSourceFormat::Pgn:
+        read_pgn_range(range, queue);
+        break;
+    case DataSourceFormat::Packed:
+        read_packed_range(range, queue);
+        break;
+    }
+}
+
+// Moves a split point forward to the start of the next line, game or record
+static int64_t align_range_start(const DataSource& source, ifstream& file, const int64_t position, const int64_t file_size)
+{
+    if (source.format == DataSourceFormat::Packed)
+    {
+        return position / sizeof(PackedBoard) * sizeof(PackedBoard);
+    }
+
+    // Games start after an empty line, "\n\r\n[" also covers CRLF files like find_last_game_start does
+    const auto separators = source.format == DataSourceFormat::Epd ? vector<string_view>{ "\n" } : vector<string_view>{ "\n\n[", "\n\r\n[" };
+    size_t max_separator_size = 0;
+    for (const auto separator : separators)
+    {
+        max_separator_size = max(max_separator_size, separator.size());
+    }
+
+    // Start early, so that a split point which already is the start of a line or game stays in place
+    auto scan_start = max<int64_t>(position - static_cast<int64_t>(max_separator_size - 1), 0);
+    file.clear();
+    file.seekg(scan_start);
+
+    string text;
+    while (scan_start < file_size)
+    {
+        text.resize(1 << 16);
+        file.read(text.data(), text.size());
+        text.resize(file.gcount());
+
+        // Earliest start of a line or game at or after the split point
+        auto best = file_size;
+        for (const auto separator : separators)
+        {
+            for (auto found = text.find(separator); found != string::npos; found = text.find(separator, found + 1))
+            {
+                const auto start = scan_start + static_cast<int64_t>(found + separator.size() - 1);
+                if (start >= position)
+                {
+                    best = min(best, start);
+                    break;
+                }
+            }
+        }
+        if (best < file_size)
+        {
+            return best;
+        }
+
+        if (text.size() < max_separator_size)
+        {
+            break;
+        }
+        scan_start += text.size() - max_separator_size + 1;
+        file.clear();
+        file.seekg(scan_start);
+    }
+
+    return file_size;
+}
+
+// Splits large sources into up to data_read_thread_count byte ranges so that they are read in parallel
+static void split_source(SourceLoadState& state, deque<RangeLoadState>& ranges)
+{
+    const auto& source = *state.source;
+    ifstream file(source.path, ios::binary | ios::ate);
+    const int64_t file_size = file.tellg();
+    const auto range_count = clamp<int64_t>(file_size / min_range_size, 1, data_read_thread_count);
+
+    vector<int64_t> boundaries = { 0 };
+    for (int64_t range_index = 1; range_index < range_count; range_index++)
+    {
+        const auto boundary = align_range_start(source, file, file_size * range_index / range_count, file_size);
+        if (boundary > boundaries.back() && boundary < file_size)
+        {
+            boundaries.push_back(boundary);
+        }
+    }
+    boundaries.push_back(file_size);
+
+    for (size_t range_index = 0; range_index + 1 < boundaries.size(); range_index++)
+    {
+        auto& range = ranges.emplace_back();
+        range.source_state = &state;
+        range.begin = boundaries[range_index];
+        range.end = boundaries[range_index + 1];
+    }
+}
+
+static void parse_block(const parameters_t& parameters, chess::Board& board, UnpackedBoard& unpacked_board, SourceLoadState& state, LoadBlock& block)
+{
+    const auto& source = *state.source;
+    switch (source.format)
+    {
+    case DataSourceFormat::Epd:
+        parse_epd_block(parameters, state, board, block);
+        break;
+    case DataSourceFormat::Pgn:
+        parse_pgn_block(parameters, state, block);
+        break;
+    case DataSourceFormat::Packed:
+        parse_packed_block(parameters, state, unpacked_board, block);
+        break;
+    }
+
+    if constexpr (use_batch_eval)
+    {
+        flush_eval_batch(parameters, state, block);
+    }
+}
+
+// Reads all data sources concurrently, with the parse workers taking blocks from any of them through a shared queue
+// Returns the squared error which merging duplicate positions took out of the entries, see DuplicateTable::apply
+static double load_sources(ThreadPool& thread_pool, const vector<DataSource>& sources, const parameters_t& parameters, const high_resolution_clock::time_point start, vector<Entry>& entries, vector<QuiescenceSource>& qsearch_sources, EntryStream* stream)
+{
+    TraceSpan span("load_sources");
+    // Counted per load or refresh, not over the whole process
+    qsearch_nodes = 0;
+    for (const auto& source : sources)
+    {
+        cout << "Reading " << source.path;
+        if (source.position_limit > 0)
+        {
+            cout << " (" << source.position_limit << " positions)";
+        }
+        cout << "..." << endl;
+
+        ifstream file(source.path);
+        if (!file)
+        {
+            cout << "Failed to open " << source.path << endl;
+            throw runtime_error("Failed to open data source");
+        }
+    }
+
+    vector<SourceLoadState> states(sources.size());
+    deque<RangeLoadState> ranges;
+    DuplicateTable duplicates;
+    for (size_t source_index = 0; source_index < sources.size(); source_index++)
+    {
+        states[source_index].source = &sources[source_index];
+        states[source_index].source_index = static_cast<int32_t>(source_index);
+        states[source_index].duplicates = &duplicates;
+        if (position_sampling != PositionSampling::First && sources[source_index].position_limit > 0)
+        {
+            states[source_index].sampler = make_unique<PositionSampler>(sources[source_index].position_limit, get_sampling_stratum_count());
+        }
+        split_source(states[source_index], ranges);
+    }
+
+    const auto reader_count = min(data_read_thread_count, static_cast<int32_t>(ranges.size()));
+    BlockQueue queue(data_load_thread_count * 2, reader_count);
+    atomic<size_t> next_range = 0;
+    for (int32_t reader_id = 0; reader_id < reader_count; reader_id++)
+    {
+        thread_pool.enqueue([&ranges, &queue, &next_range]()
+        {
+            for (auto range_index = next_range++; range_index < ranges.size(); range_index = next_range++)
+            {
+                TraceSpan span("read_range");
+                read_range(ranges[range_index], queue);
+            }
+            queue.producer_done();
+        });
+    }
+
+    atomic<int64_t> parsed_count = 0;
+    for (int32_t thread_id = 0; thread_id < data_load_thread_count; thread_id++)
+    {
+        thread_pool.enqueue([&parameters, &queue, &parsed_count, stream, start]()
+        {
+            chess::Board board;
+            UnpackedBoard unpacked_board;
+            BlockJob job;
+            while (queue.pop(job))
+            {
+                {
+                    TraceSpan span("parse_block");
+                    StageTimer timer(Stage::Parse);
+                    parse_block(parameters, board, unpacked_board, *job.state, *job.block);
+                    timer.add_items(job.block->position_count);
+                }
+                if (stream)
+                {
+                    stream->write(job.block->entries);
+                    job.block->streamed_count = job.block->entries.size();
+                    vector<Entry>().swap(job.block->entries);
+                }
+
+                const auto block_count = job.block->position_count;
+                const auto previous_count = parsed_count.fetch_add(block_count);
+                if (previous_count / TuneEval::data_load_print_interval != (previous_count + block_count) / TuneEval::data_load_print_interval)
+                {
+                    print_elapsed(start);
+                    cout << "Parsed ~" << previous_count + block_count << " positions..." << endl;
+                }
+            }
+        });
+    }
+
+    thread_pool.wait_for_completion();
+
+    // Collecting the blocks into the entries, with sampling and duplicate merging
+    TraceSpan merge_span("merge");
+    StageTimer merge_timer(Stage::Merge);
+    vector<uint64_t> position_hashes;
+    int64_t total_duplicate_count = 0;
+    size_t block_entry_count = 0;
+    for (const auto& range : ranges)
+    {
+        for (const auto& block : range.blocks)
+        {
+            block_entry_count += block.entries.size();
+        }
+    }
+    entries.reserve(entries.size() + block_entry_count);
+
+    for (auto& state : states)
+    {
+        const auto initial_entry_count = entries.size();
+        int64_t streamed_count = 0;
+        int64_t position_count = 0;
+        int64_t duplicate_count = 0;
+        int64_t skipped_games = 0;
+        for (auto& range : ranges)
+        {
+            if (range.source_state != &state)
+            {
+                continue;
+            }
+
+            for (auto& block : range.blocks)
+            {
+                // Moved, so that the coefficients of every entry aren't copied while the blocks still hold them
+                entries.insert(entries.end(), make_move_iterator(block.entries.begin()), make_move_iterator(block.entries.end()));
+                qsearch_sources.insert(qsearch_sources.end(), block.qsearch_sources.begin(), block.qsearch_sources.end());
+                position_hashes.insert(position_hashes.end(), block.position_hashes.begin(), block.position_hashes.end());
+                position_count += block.position_count;
+                streamed_count += block.streamed_count;
+                duplicate_count += block.duplicate_count;
+                skipped_games += block.skipped_games;
+            }
+            range.blocks.clear();
+        }
+
+        print_elapsed(start);
+        if (state.sampler)
+        {
+            state.sampler->collect(entries, qsearch_sources, position_hashes);
+            cout << "Sampled " << entries.size() - initial_entry_count << " of " << position_count << " positions from " << state.source->path;
+        }
+        else
+        {
+            cout << "Loaded " << entries.size() - initial_entry_count + streamed_count << " positions from " << state.source->path;
+        }
+        if (duplicate_count > 0)
+        {
+            cout << ", merged " << duplicate_count << " duplicates";
+        }
+        if (skipped_games > 0)
+        {
+            cout << ", skipped " << skipped_games << " games without a result or with unreadable moves";
+        }
+        cout << endl;
+        total_duplicate_count += duplicate_count;
+    }
+
+    double wdl_deviation = 0;
+    if constexpr (deduplicate_positions)
+    {
+        // A position sampled by several sources is kept once, as the entry of the first of them. Duplicates may be
+        // found in any source, so the averages are only final after loading everything.
+        unordered_set<uint64_t> kept_hashes;
+        size_t kept_count = 0;
+        for (size_t entry_index = 0; entry_index < entries.size(); entry_index++)
+        {
+            if (!kept_hashes.insert(position_hashes[entry_index]).second)
+            {
+                total_duplicate_count++;
+                continue;
+            }
+
+            wdl_deviation += duplicates.apply(entries[entry_index], position_hashes[entry_index]);
+            if (kept_count != entry_index)
+            {
+                entries[kept_count] = std::move(entries[entry_index]);
+                if constexpr (refresh_qsearch)
+                {
+                    qsearch_sources[kept_count] = qsearch_sources[entry_index];
+                }
+            }
+            kept_count++;
+        }
+        entries.resize(kept_count);
+        if constexpr (refresh_qsearch)
+        {
+            qsearch_sources.resize(kept_count);
+        }
+
+        print_elapsed(start);
+        cout << "Merged " << total_duplicate_count << " duplicate positions into " << entries.size() << " entries" << endl;
+    }
+    merge_timer.add_items(static_cast<int64_t>(entries.size()));
+
+    if (stream)
+    {
+        // Sampled positions are only known after loading everything
+        if (!entries.empty())
+        {
+            stream->write(entries);
+            vector<Entry>().swap(entries);
+        }
+        stream->finish();
+    }
+
+    return wdl_deviation;
+}
+
+static void refresh_qsearch_entries(ThreadPool& thread_pool, vector<Entry>& entries, vector<QuiescenceSource>& qsearch_sources, const parameters_t& parameters, const parameters_t& initial_parameters)
+{
+    qsearch_nodes = 0;
+    array<int64_t, thread_count> thread_changed{};
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        thread_pool.enqueue([thread_id, &thread_changed, &entries, &qsearch_sources, &parameters, &initial_parameters]()
+        {
+            const auto entries_per_thread = entries.size() / thread_count;
+            const auto start = thread_id * entries_per_thread;
+            const auto end = thread_id == thread_count - 1 ? entries.size() : (thread_id + 1) * entries_per_thread;
+            UnpackedBoard board;
+            for (auto i = start; i < end; i++)
+            {
+                auto& qsearch_source = qsearch_sources[i];
+                board.unpack(qsearch_source.board);
+                const auto leaf = quiescence_root(parameters, board);
+                if (leaf.hash() == qsearch_source.leaf_hash)
+                {
+                    continue;
+                }
+
+                // The WDL target belongs to the source position and is kept as is
+                build_entry(leaf, initial_parameters, entries[i]);
+                qsearch_source.leaf_hash = leaf.hash();
+                thread_changed[thread_id]++;
+            }
+        });
+    }
+
+    thread_pool.wait_for_completion();
+
+    int64_t changed = 0;
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        changed += thread_changed[thread_id];
+    }
+    cout << "Re-quiesced " << entries.size() << " positions with " << qsearch_nodes.load() << " nodes, " << changed << " entries changed" << endl;
+}
+
+static uint64_t get_pattern_hash(const Entry& entry)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const auto add = [&hash](const uint64_t value)
+    {
+        hash = (hash ^ value) * 0x100000001B3ULL;
+    };
+
+    for (const auto& coefficient : entry.coefficients)
+    {
+        add((static_cast<uint64_t>(static_cast<uint16_t>(coefficient.index)) << 16) | static_cast<uint16_t>(coefficient.value));
+    }
+    add(bit_cast<uint32_t>(static_cast<float>(entry.additional_score)));
+    for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+    {
+        add(bit_cast<uint32_t>(static_cast<float>(entry.stage_weights[stage])));
+    }
+    return hash;
+}
+
+// Whether two entries always have the same eval, regardless of the parameters
+static bool is_same_pattern(const Entry& left, const Entry& right)
+{
+    if (left.additional_score != right.additional_score || left.coefficients.size() != right.coefficients.size() || left.stage_weights != right.stage_weights)
+    {
+        return false;
+    }
+
+    for (size_t coefficient_index = 0; coefficient_index < left.coefficients.size(); coefficient_index++)
+    {
+        const auto& left_coefficient = left.coefficients[coefficient_index];
+        const auto& right_coefficient = right.coefficients[coefficient_index];
+        if (left_coefficient.index != right_coefficient.index || left_coefficient.value != right_coefficient.value)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Merges entries with identical coefficients into one entry, weighted by the entries it replaces.
+// The weighted squared error only differs by a constant, so the gradient stays the same.
+// Returns that constant, the weighted squared deviation of the WDLs from their pattern's mean. Compacted entries
+// only keep the mean, so it is added back to the error to keep it comparable with uncompacted runs.
+static double compact_entries(ThreadPool& thread_pool, vector<Entry>& entries)
+{
+    vector<uint64_t> hashes(entries.size());
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        thread_pool.enqueue([thread_id, &entries, &hashes]()
+        {
+            const auto entries_per_thread = entries.size() / thread_count;
+            const auto start = thread_id * entries_per_thread;
+            const auto end = thread_id == thread_count - 1 ? entries.size() : (thread_id + 1) * entries_per_thread;
+            for (auto i = start; i < end; i++)
+            {
+                hashes[i] = get_pattern_hash(entries[i]);
+            }
+        });
+    }
+
+    thread_pool.wait_for_completion();
+
+    // Hash collisions between different patterns are left unmerged
+    unordered_map<uint64_t, size_t> pattern_indices;
+    pattern_indices.reserve(entries.size());
+    vector<double> wdl_sums;
+    vector<double> squared_wdl_sums;
+    size_t pattern_count = 0;
+    for (size_t entry_index = 0; entry_index < entries.size(); entry_index++)
+    {
+        auto& entry = entries[entry_index];
+        const auto [pattern, inserted] = pattern_indices.try_emplace(hashes[entry_index], pattern_count);
+        if (!inserted && is_same_pattern(entries[pattern->second], entry))
+        {
+            auto& pattern_entry = entries[pattern->second];
+            wdl_sums[pattern->second] += static_cast<double>(entry.wdl) * entry.weight;
+            squared_wdl_sums[pattern->second] += static_cast<double>(entry.wdl) * entry.wdl * entry.weight;
+            pattern_entry.weight += entry.weight;
+            continue;
+        }
+
+        wdl_sums.push_back(static_cast<double>(entry.wdl) * entry.weight);
+        squared_wdl_sums.push_back(static_cast<double>(entry.wdl) * entry.wdl * entry.weight);
+        if (pattern_count != entry_index)
+        {
+            entries[pattern_count] = std::move(entry);
+        }
+        pattern_count++;
+    }
+
+    const auto entry_count = entries.size();
+    entries.resize(pattern_count);
+    double wdl_deviation = 0;
+    for (size_t pattern_index = 0; pattern_index < pattern_count; pattern_index++)
+    {
+        auto& entry = entries[pattern_index];
+        const auto mean_wdl = wdl_sums[pattern_index] / entry.weight;
+        entry.wdl = static_cast<tune_t>(mean_wdl);
+        wdl_deviation += max(squared_wdl_sums[pattern_index] - mean_wdl * wdl_sums[pattern_index], 0.0);
+    }
+
+    cout << "Compacted " << entry_count << " entries into " << pattern_count << " coefficient patterns" << endl << endl;
+    return wdl_deviation;
+}
+
+static tune_t sigmoid(const tune_t K, const tune_t eval)
+{
+    return static_cast<tune_t>(1) / (static_cast<tune_t>(1) + exp(-K * eval / static_cast<tune_t>(400)));
+}
+
+// Number of source positions behind the entries
+static tune_t get_total_weight(const vector<Entry>& entries)
+{
+    double total_weight = 0;
+    for (const auto& entry : entries)
+    {
+        total_weight += entry.weight;
+    }
+    return static_cast<tune_t>(total_weight);
+}
+
+// Weighted sum of the squared errors, to be divided by the total weight of all entries
+static tune_t get_error_sum(ThreadPool& thread_pool, const vector<Entry>& entries, const parameters_t& parameters, tune_t K)
+{
+    array<tune_t, thread_count> thread_errors;
+    for(int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        thread_pool.enqueue([thread_id, &thread_errors, &entries, &parameters, K]()
+        {
+            const auto entries_per_thread = entries.size() / thread_count;
+            const auto start = static_cast<int>(thread_id * entries_per_thread);
+            const auto end = static_cast<int>(thread_id == thread_count - 1 ? entries.size() : (thread_id + 1) * entries_per_thread);
+            TraceSpan span("error");
+            tune_t error = 0;
+            for (int i = start; i < end; i++)
+            {
+                const auto& entry = entries[i];
+                const auto eval = linear_eval(entry, parameters);
+                const auto sig = sigmoid(K, eval);
+                const auto diff = entry.wdl - sig;
+                const auto entry_error = pow(diff, 2);
+                error += entry.weight * entry_error;
+            }
+            thread_errors[thread_id] = error;
+        });
+    }
+
+    thread_pool.wait_for_completion();
+
+    tune_t total_error = 0;
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        total_error += thread_errors[thread_id];
+    }
+
+    return total_error;
+}
+
+// wdl_deviation is the squared error the entries no longer hold after merging positions, see load_sources and compact_entries
+static tune_t get_average_error(ThreadPool& thread_pool, const vector<Entry>& entries, EntryStream* stream, const tune_t total_weight, const tune_t wdl_deviation, const parameters_t& parameters, tune_t K)
+{
+    tune_t total_error = 0;
+    for_each_entry_shard(entries, stream, [&](const vector<Entry>& shard)
+    {
+        total_error += get_error_sum(thread_pool, shard, parameters, K);
+    });
+    total_error += wdl_deviation;
+
+    const tune_t avg_error = total_error / total_weight;
+    return avg_error;
+}
+
+static tune_t find_optimal_k(ThreadPool& thread_pool, const vector<Entry>& entries, EntryStream* stream, const tune_t total_weight, const tune_t wdl_deviation, const parameters_t& parameters)
+{
+    constexpr tune_t rate = 10;
+    constexpr tune_t delta = 1e-5;
+    constexpr tune_t deviation_goal = 1e-6;
+    TraceSpan span("k_search");
+    StageTimer timer(Stage::KSearch);
+    tune_t K = 2.5;
+    tune_t deviation = 1;
+
+    while (fabs(deviation) > deviation_goal)
+    {
+        const tune_t up = get_average_error(thread_pool, entries, stream, total_weight, wdl_deviation, parameters, K + delta);
+        const tune_t down = get_average_error(thread_pool, entries, stream, total_weight, wdl_deviation, parameters, K - delta);
+        deviation = (up - down) / (2 * delta);
+        timer.add_items(1);
+        cout << "Current K: " << K << ", up: " << up << ", down: " << down << ", deviation: " << deviation << endl;
+        K -= deviation * rate;
+    }
+
+    return K;
+}
+
+static void update_single_gradient(StageArrays& gradient, const Entry& entry, const parameters_t& params, tune_t K) {
+
+    const tune_t eval = linear_eval(entry, params);
+    const tune_t sig = sigmoid(K, eval);
+    const tune_t res = entry.weight * (entry.wdl - sig) * sig * (1 - sig);
+
+    array<tune_t, Phase::stage_count> stage_bases;
+    for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+    {
+        stage_bases[stage] = res * entry.stage_weights[stage];
+    }
+
+    for (const auto& coefficient : entry.coefficients)
+    {
+        for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+        {
+            gradient[stage][coefficient.index] += stage_bases[stage] * coefficient.value;
+        }
+    }
+}
+
+static void compute_gradient(ThreadPool& thread_pool, StageArrays& gradient, const vector<Entry>& entries, const parameters_t& params, tune_t K)
+{
+    // Kept between calls to avoid reallocating them every epoch
+    static array<StageArrays, thread_count> thread_gradients;
+
+    for(int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        thread_pool.enqueue([thread_id, &entries, &params, K]()
+        {
+            const auto entries_per_thread = entries.size() / thread_count;
+            const auto start = static_cast<int>(thread_id * entries_per_thread);
+            const auto end = static_cast<int>(thread_id == thread_count - 1 ? entries.size() : (thread_id + 1) * entries_per_thread);
+            TraceSpan span("gradient");
+            StageTimer timer(Stage::Gradient);
+            timer.add_items(end - start);
+            auto& gradient = thread_gradients[thread_id];
+            for (auto& stage_gradient : gradient.stages)
+            {
+                stage_gradient.fill(0);
+            }
+            for (int i = start; i < end; i++)
+            {
+                const auto& entry = entries[i];
+                update_single_gradient(gradient, entry, params, K);
+            }
+        });
+    }
+
+    thread_pool.wait_for_completion();
+
+    TraceSpan span("reduction");
+    StageTimer timer(Stage::Reduction);
+    timer.add_items(thread_count);
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+        {
+            auto& stage_gradient = gradient[stage];
+            const auto& thread_stage_gradient = thread_gradients[thread_id][stage];
+            for (int32_t parameter_index = 0; parameter_index < parameter_count; parameter_index++)
+            {
+                stage_gradient[parameter_index] += thread_stage_gradient[parameter_index];
+            }
+        }
+    }
+}
+
+// Sparse coefficients transposed to parameter-major order: for every parameter, the entries
+// which use it and its coefficient in them. Lets a subset of parameters be tuned without
+// going through the entries which don't depend on any of them.
+struct FeatureIndex
+{
+    vector<uint64_t> offsets;
+    vector<uint32_t> entry_indices;
+    vector<int16_t> values;
+
+    // Scratch space to collect each entry affected by a block of parameters only once
+    vector<uint32_t> entry_stamps;
+    uint32_t stamp = 0;
+    vector<uint32_t> affected_entries;
+    vector<tune_t> residuals;
+
+    // Eval of every entry under the current parameters, kept up to date through the index
+    vector<tune_t> evals;
+};
+
+static void build_feature_index(const vector<Entry>& entries, const size_t parameter_count, FeatureIndex& index)
+{
+    if (entries.size() > numeric_limits<uint32_t>::max())
+    {
+        throw runtime_error("Too many entries for the feature index");
+    }
+
+    index.offsets.assign(parameter_count + 1, 0);
+    for (const auto& entry : entries)
+    {
+        for (const auto& coefficient : entry.coefficients)
+        {
+            index.offsets[coefficient.index + 1]++;
+        }
+    }
+
+    for (size_t parameter_index = 0; parameter_index < parameter_count; parameter_index++)
+    {
+        index.offsets[parameter_index + 1] += index.offsets[parameter_index];
+    }
+
+    index.entry_indices.resize(index.offsets.back());
+    index.values.resize(index.offsets.back());
+    vector<uint64_t> positions(index.offsets.begin(), index.offsets.end() - 1);
+    for (uint32_t entry_index = 0; entry_index < entries.size(); entry_index++)
+    {
+        for (const auto& coefficient : entries[entry_index].coefficients)
+        {
+            const auto position = positions[coefficient.index]++;
+            index.entry_indices[position] = entry_index;
+            index.values[position] = coefficient.value;
+        }
+    }
+
+    index.entry_stamps.assign(entries.size(), 0);
+    index.stamp = 0;
+    index.residuals.resize(entries.size());
+}
+
+// Gradient of the parameters in [block_begin, block_end), only going through the entries which use them
+static void compute_block_gradient(ThreadPool& thread_pool, StageArrays& gradient, const vector<Entry>& entries, FeatureIndex& index, const parameters_t& params, tune_t K, const int32_t block_begin, const int32_t block_end)
+{
+    index.stamp++;
+    index.affected_entries.clear();
+    for (auto position = index.offsets[block_begin]; position < index.offsets[block_end]; position++)
+    {
+        const auto entry_index = index.entry_indices[position];
+        if (index.entry_stamps[entry_index] != index.stamp)
+        {
+            index.entry_stamps[entry_index] = index.stamp;
+            index.affected_entries.push_back(entry_index);
+        }
+    }
+
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        thread_pool.enqueue([thread_id, &entries, &index, &params, K]()
+        {
+            const auto& affected_entries = index.affected_entries;
+            const auto entries_per_thread = affected_entries.size() / thread_count;
+            const auto start = thread_id * entries_per_thread;
+            const auto end = thread_id == thread_count - 1 ? affected_entries.size() : (thread_id + 1) * entries_per_thread;
+            TraceSpan span("residuals");
+            StageTimer timer(Stage::Gradient);
+            timer.add_items(static_cast<int64_t>(end - start));
+            for (auto i = start; i < end; i++)
             {
-                vector<string> thread_batch;
+                const auto& entry = entries[affected_entries[i]];
+                tune_t eval;
+                if constexpr (use_eval_cache)
                 {
-                    lock_guard lock(mut);
-                    if(batches.empty())
-                    {
-                        break;
-                    }
-                    thread_batch = batches.front();
-                    batches.pop();
+                    eval = index.evals[affected_entries[i]];
                 }
-
-                constexpr auto thread_data_load_print_interval = TuneEval::data_load_print_interval / data_load_thread_count;
-                for(auto& fen : thread_batch)
+                else
                 {
-                    parse_fen(side_to_move_wdl, parameters, entries, fen);
-                    position_count++;
-                    if (thread_id == 0 && position_count % thread_data_load_print_interval == 0)
-                    {
-                        print_elapsed(time_start);
-                        std::cout << "Parsed ~" << position_count * data_load_thread_count << " positions..." << endl;
-                    }
+                    eval = linear_eval(entry, params);
                 }
+                const tune_t sig = sigmoid(K, eval);
+                index.residuals[affected_entries[i]] = entry.weight * (entry.wdl - sig) * sig * (1 - sig);
             }
-
-            thread_entries[thread_id] = entries;
         });
     }
 
     thread_pool.wait_for_completion();
 
-    for (int thread_id = 0; thread_id < data_load_thread_count; thread_id++)
+    // Every parameter is owned by a single thread, so the gradient doesn't need per-thread copies
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
     {
-        for(const Entry& entry : thread_entries[thread_id])
+        thread_pool.enqueue([thread_id, &gradient, &entries, &index, block_begin, block_end]()
         {
-            entries.push_back(entry);
-        }
+            TraceSpan span("block_gradient");
+            StageTimer timer(Stage::Gradient);
+            for (auto parameter_index = block_begin + thread_id; parameter_index < block_end; parameter_index += thread_count)
+            {
+                for (auto position = index.offsets[parameter_index]; position < index.offsets[parameter_index + 1]; position++)
+                {
+                    const auto entry_index = index.entry_indices[position];
+                    const auto res = index.residuals[entry_index];
+                    const auto value = index.values[position];
+                    const auto& stage_weights = entries[entry_index].stage_weights;
+                    for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+                    {
+                        gradient[stage][parameter_index] += res * stage_weights[stage] * value;
+                    }
+                }
+            }
+        });
     }
-}
 
-static void load_fens(ThreadPool& thread_pool, const DataSource& source, const parameters_t& parameters, const high_resolution_clock::time_point start, vector<Entry>& entries)
-{
-    vector<string> fens;
-    read_fens(source, start, fens);
-    parse_fens(thread_pool, source, fens, parameters, start, entries);
+    thread_pool.wait_for_completion();
 }
 
-static tune_t sigmoid(const tune_t K, const tune_t eval)
+static void refresh_entry_evals(ThreadPool& thread_pool, const vector<Entry>& entries, FeatureIndex& index, const parameters_t& params)
 {
-    return static_cast<tune_t>(1) / (static_cast<tune_t>(1) + exp(-K * eval / static_cast<tune_t>(400)));
+    index.evals.resize(entries.size());
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+    {
+        thread_pool.enqueue([thread_id, &entries, &index, &params]()
+        {
+            const auto entries_per_thread = entries.size() / thread_count;
+            const auto start = thread_id * entries_per_thread;
+            const auto end = thread_id == thread_count - 1 ? entries.size() : (thread_id + 1) * entries_per_thread;
+            for (auto i = start; i < end; i++)
+            {
+                index.evals[i] = linear_eval(entries[i], params);
+            }
+        });
+    }
+
+    thread_pool.wait_for_completion();
 }
 
-static tune_t get_average_error(ThreadPool& thread_pool, const vector<Entry>& entries, const parameters_t& parameters, tune_t K)
+// Adds the change of the parameters in [block_begin, block_end) to the cached evals of the entries using them
+static void update_entry_evals(ThreadPool& thread_pool, const vector<Entry>& entries, FeatureIndex& index, const parameters_t& params, const parameters_t& block_previous, const int32_t block_begin, const int32_t block_end)
 {
-    array<tune_t, thread_count> thread_errors;
-    for(int thread_id = 0; thread_id < thread_count; thread_id++)
+    for (int thread_id = 0; thread_id < thread_count; thread_id++)
     {
-        thread_pool.enqueue([thread_id, &thread_errors, &entries, &parameters, K]()
+        thread_pool.enqueue([thread_id, &entries, &index, &params, &block_previous, block_begin, block_end]()
         {
+            // Index rows are sorted by entry, so every thread updates its own range of entries without locking
             const auto entries_per_thread = entries.size() / thread_count;
-            const auto start = static_cast<int>(thread_id * entries_per_thread);
-            const auto end = static_cast<int>((thread_id + 1) * entries_per_thread - 1);
-            tune_t error = 0;
-            for (int i = start; i < end; i++)
+            const auto start = static_cast<uint32_t>(thread_id * entries_per_thread);
+            const auto end = static_cast<uint32_t>(thread_id == thread_count - 1 ? entries.size() : (thread_id + 1) * entries_per_thread);
+            for (auto parameter_index = block_begin; parameter_index < block_end; parameter_index++)
             {
-                const auto& entry = entries[i];
-                const auto eval = linear_eval(entry, parameters);
-                const auto sig = sigmoid(K, eval);
-                const auto diff = entry.wdl - sig;
-                const auto entry_error = pow(diff, 2);
-                error += entry_error;
+                const auto& previous = block_previous[parameter_index - block_begin];
+                array<tune_t, Phase::stage_count> deltas;
+                for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+                {
+                    deltas[stage] = Phase::get(params[parameter_index], stage) - Phase::get(previous, stage);
+                }
+
+                const auto row_begin = index.entry_indices.begin() + index.offsets[parameter_index];
+                const auto row_end = index.entry_indices.begin() + index.offsets[parameter_index + 1];
+                for (auto it = lower_bound(row_begin, row_end, start); it != row_end && *it < end; ++it)
+                {
+                    const auto value = index.values[it - index.entry_indices.begin()];
+                    const auto& stage_weights = entries[*it].stage_weights;
+                    tune_t delta = 0;
+                    for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+                    {
+                        delta += deltas[stage] * stage_weights[stage];
+                    }
+                    index.evals[*it] += value * delta;
+                }
             }
-            thread_errors[thread_id] = error;
         });
     }
 
     thread_pool.wait_for_completion();
+}
 
-    tune_t total_error = 0;
-    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+// Named parameter ranges are optional for engines
+template<typename Eval>
+static vector<ParameterRange> get_parameter_ranges()
+{
+    if constexpr (requires { Eval::get_parameter_ranges(); })
     {
-        total_error += thread_errors[thread_id];
+        return Eval::get_parameter_ranges();
+    }
+    else
+    {
+        return {};
     }
-
-    const tune_t avg_error = total_error / static_cast<tune_t>(entries.size());
-    return avg_error;
 }
 
-static tune_t find_optimal_k(ThreadPool& thread_pool, const vector<Entry>& entries, const parameters_t& parameters)
+static void freeze_parameter_item(const string_view item, vector<uint8_t>& mask)
 {
-    constexpr tune_t rate = 10;
-    constexpr tune_t delta = 1e-5;
-    constexpr tune_t deviation_goal = 1e-6;
-    tune_t K = 2.5;
-    tune_t deviation = 1;
+    for (const auto& range : get_parameter_ranges<TuneEval>())
+    {
+        if (range.name == item)
+        {
+            fill_n(mask.begin() + range.begin, range.size, 1);
+            return;
+        }
+    }
 
-    while (fabs(deviation) > deviation_goal)
+    // Otherwise a parameter index or an inclusive index range like 6-69
+    int32_t first = 0;
+    int32_t last = 0;
+    const auto separator = item.find('-');
+    const auto first_token = item.substr(0, separator);
+    auto [first_end, first_error] = from_chars(first_token.data(), first_token.data() + first_token.size(), first);
+    last = first;
+    bool valid = first_error == errc() && first_end == first_token.data() + first_token.size();
+    if (valid && separator != string_view::npos)
     {
-        const tune_t up = get_average_error(thread_pool, entries, parameters, K + delta);
-        const tune_t down = get_average_error(thread_pool, entries, parameters, K - delta);
-        deviation = (up - down) / (2 * delta);
-        cout << "Current K: " << K << ", up: " << up << ", down: " << down << ", deviation: " << deviation << endl;
-        K -= deviation * rate;
+        const auto last_token = item.substr(separator + 1);
+        auto [last_end, last_error] = from_chars(last_token.data(), last_token.data() + last_token.size(), last);
+        valid = last_error == errc() && last_end == last_token.data() + last_token.size();
     }
 
-    return K;
-}
+    if (!valid || first < 0 || last < first || last >= static_cast<int32_t>(mask.size()))
+    {
+        cout << "Unknown frozen parameter " << item << endl;
+        throw runtime_error("Unknown frozen parameter");
+    }
 
-static void update_single_gradient(parameters_t& gradient, const Entry& entry, const parameters_t& params, tune_t K) {
+    fill(mask.begin() + first, mask.begin() + last + 1, 1);
+}
 
-    const tune_t eval = linear_eval(entry, params);
-    const tune_t sig = sigmoid(K, eval);
-    const tune_t res = (entry.wdl - sig) * sig * (1 - sig);
+// Items are separated by commas or new lines, lines starting with # are comments
+static void freeze_parameter_items(const string_view items, vector<uint8_t>& mask)
+{
+    size_t item_start = 0;
+    while (item_start < items.size())
+    {
+        auto item_end = items.find_first_of(",\n", item_start);
+        if (item_end == string_view::npos)
+        {
+            item_end = items.size();
+        }
 
-#if TAPERED
-    const auto mg_base = res * (entry.phase / static_cast<tune_t>(24));
-    const auto eg_base = res - mg_base;
-#endif
+        auto item = items.substr(item_start, item_end - item_start);
+        while (!item.empty() && isspace(static_cast<unsigned char>(item.front())))
+        {
+            item.remove_prefix(1);
+        }
+        while (!item.empty() && isspace(static_cast<unsigned char>(item.back())))
+        {
+            item.remove_suffix(1);
+        }
 
-    for (const auto& coefficient : entry.coefficients)
-    {
-#if TAPERED
-        gradient[coefficient.index][static_cast<int32_t>(PhaseStages::Midgame)] += mg_base * coefficient.value;
-        gradient[coefficient.index][static_cast<int32_t>(PhaseStages::Endgame)] += eg_base * coefficient.value * entry.endgame_scale;
-#else
-        gradient[coefficient.index] += res * coefficient.value;
-#endif
+        if (!item.empty() && item.front() != '#')
+        {
+            freeze_parameter_item(item, mask);
+        }
+        item_start = item_end + 1;
     }
 }
 
-static void compute_gradient(ThreadPool& thread_pool, parameters_t& gradient, const vector<Entry>& entries, const parameters_t& params, tune_t K)
+// Adam update of the parameters in [begin, end), one contiguous pass per stage. Frozen parameters
+// have no coefficients left in the entries, so their gradient and moments stay zero and so does their step.
+// Untapered parameters get the gradient of all their stages in every stage, so the stages take the same steps.
+static void adam_step(parameters_t& parameters, StageArrays& gradient, StageArrays& momentum, StageArrays& velocity, const tune_t gradient_scale, const tune_t learning_rate, const int32_t begin, const int32_t end)
 {
-    array<parameters_t, thread_count> thread_gradients;
-    for(int thread_id = 0; thread_id < thread_count; thread_id++)
+    constexpr tune_t beta1 = 0.9;
+    constexpr tune_t beta2 = 0.999;
+    TraceSpan span("optimizer");
+    StageTimer timer(Stage::Optimizer);
+    timer.add_items(end - begin);
+
+    for (const auto& range : untapered_ranges)
     {
-        thread_pool.enqueue([thread_id, &thread_gradients, &entries, &params, K]()
+        for (int32_t parameter_index = max(range.begin, begin); parameter_index < min(range.begin + range.size, end); parameter_index++)
         {
-            const auto entries_per_thread = entries.size() / thread_count;
-            const auto start = static_cast<int>(thread_id * entries_per_thread);
-            const auto end = static_cast<int>((thread_id + 1) * entries_per_thread - 1);
-#if TAPERED
-            parameters_t gradient = parameters_t(params.size(), pair_t{});
-#else
-            parameters_t gradient = parameters_t(params.size(), 0);
-#endif
-            for (int i = start; i < end; i++)
+            tune_t sum = 0;
+            for (int32_t stage = 0; stage < Phase::stage_count; stage++)
             {
-                const auto& entry = entries[i];
-                update_single_gradient(gradient, entry, params, K);
+                sum += gradient[stage][parameter_index];
             }
-            thread_gradients[thread_id] = gradient;
-        });
+            for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+            {
+                gradient[stage][parameter_index] = sum;
+            }
+        }
     }
 
-    thread_pool.wait_for_completion();
+    for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+    {
+        const auto& stage_gradient = gradient[stage];
+        auto& stage_momentum = momentum[stage];
+        auto& stage_velocity = velocity[stage];
+        for (int32_t parameter_index = begin; parameter_index < end; parameter_index++)
+        {
+            const tune_t grad = gradient_scale * stage_gradient[parameter_index];
+            stage_momentum[parameter_index] = beta1 * stage_momentum[parameter_index] + (1 - beta1) * grad;
+            stage_velocity[parameter_index] = beta2 * stage_velocity[parameter_index] + (1 - beta2) * grad * grad;
+            Phase::get(parameters[parameter_index], stage) -= learning_rate * stage_momentum[parameter_index] / (static_cast<tune_t>(1e-8) + sqrt(stage_velocity[parameter_index]));
+        }
+    }
+}
 
-    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+static void load_frozen_mask(const size_t parameter_count)
+{
+    vector<uint8_t> mask(parameter_count, 0);
+    freeze_parameter_items(frozen_parameters, mask);
+
+    if (string_view(frozen_parameters_path) != "")
+    {
+        ifstream file(frozen_parameters_path);
+        if (!file)
+        {
+            cout << "Failed to open " << frozen_parameters_path << endl;
+            throw runtime_error("Failed to open frozen parameters file");
+        }
+
+        stringstream contents;
+        contents << file.rdbuf();
+        freeze_parameter_items(contents.str(), mask);
+    }
+
+    const auto frozen_count = count(mask.begin(), mask.end(), 1);
+    if (frozen_count > 0)
+    {
+        cout << "Freezing " << frozen_count << " of " << parameter_count << " parameters" << endl;
+        frozen_mask = move(mask);
+    }
+}
+
+// Starts the stages of untapered parameters at their average. Done before loading, so frozen
+// parameters are folded into the entries with the values they are printed with.
+static void load_untapered_ranges(parameters_t& parameters)
+{
+    untapered_ranges.clear();
+    if constexpr (Phase::tapered)
     {
-        for(auto parameter_index = 0; parameter_index < params.size(); parameter_index++)
+        for (const auto& range : get_parameter_ranges<TuneEval>())
         {
-#if TAPERED
-            gradient[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)] += thread_gradients[thread_id][parameter_index][static_cast<int32_t>(PhaseStages::Midgame)];
-            gradient[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)] += thread_gradients[thread_id][parameter_index][static_cast<int32_t>(PhaseStages::Endgame)];
-#else
-            gradient[parameter_index] += thread_gradients[thread_id][parameter_index];
-#endif
+            if (range.tapered)
+            {
+                continue;
+            }
+
+            untapered_ranges.push_back(range);
+            for (int32_t parameter_index = range.begin; parameter_index < range.begin + range.size; parameter_index++)
+            {
+                auto& parameter = parameters[parameter_index];
+                tune_t sum = 0;
+                for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+                {
+                    sum += Phase::get(parameter, stage);
+                }
+                for (int32_t stage = 0; stage < Phase::stage_count; stage++)
+                {
+                    Phase::get(parameter, stage) = sum / Phase::stage_count;
+                }
+            }
         }
     }
 }
 
-void Tuner::run(const std::vector<DataSource>& sources)
+}
+
+namespace Tuner::TUNER_ENGINE
+{
+void run(const std::vector<DataSource>& sources)
 {
     cout << "Starting tuning" << endl << endl;
     const auto start = high_resolution_clock::now();
+    if constexpr (enable_trace_events)
+    {
+        TraceEvents::start(trace_event_buffer_size);
+    }
 
     cout << "Starting thread pool..." << endl;
     ThreadPool thread_pool;
@@ -822,11 +2726,17 @@ void Tuner::run(const std::vector<DataSource>& sources)
     cout << "Getting initial parameters..." << endl;
     auto parameters = TuneEval::get_initial_parameters();
     cout << "Got " << parameters.size() << " parameters" << endl;
+    if (parameters.size() != parameter_count)
+    {
+        throw runtime_error("Initial parameter count doesn't match the engine's parameter_count of " + to_string(parameter_count));
+    }
 
     cout << "Initial parameters:" << endl;
     TuneEval::print_parameters(parameters);
 
+    const parameters_t initial_parameters = parameters;
     vector<Entry> entries;
+    vector<QuiescenceSource> qsearch_sources;
 
     // Debug entry
     //const string debug_fen = "rnb1kbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQK1NR w KQkq - 0 1; 1.0";
@@ -837,25 +2747,60 @@ void Tuner::run(const std::vector<DataSource>& sources)
     //debug_entry.initial_eval = linear_eval(debug_entry, parameters);
     //entries.push_back(debug_entry);
 
-    vector<string> fens;
-    for (const auto& source : sources)
+    unique_ptr<EntryStream> stream;
+    if constexpr (stream_entries)
     {
-        load_fens(thread_pool, source, parameters, start, entries);
+        stream = make_unique<EntryStream>(stream_directory);
     }
+
+    load_untapered_ranges(parameters);
+    load_frozen_mask(parameter_count);
+    const auto duplicate_wdl_deviation = load_sources(thread_pool, sources, parameters, start, entries, qsearch_sources, stream.get());
     cout << "Data loading complete" << endl << endl;
+    export_instrumentation(start);
+    export_trace_events();
+
+    const auto entry_count = stream ? stream->size() : entries.size();
+    if constexpr (TuneEval::enable_qsearch)
+    {
+        const auto nodes = qsearch_nodes.load();
+        cout << "Qsearch nodes: " << nodes << " (" << static_cast<tune_t>(nodes) / entry_count << " per position)" << endl << endl;
+    }
+
+    DatasetStatistics statistics;
+    for_each_entry_shard(entries, stream.get(), [&statistics](const vector<Entry>& shard)
+    {
+        statistics.add(shard);
+    });
+    statistics.print(parameters);
+
+    auto wdl_deviation = static_cast<tune_t>(duplicate_wdl_deviation);
+    if constexpr (compact_coefficient_patterns)
+    {
+        wdl_deviation += static_cast<tune_t>(compact_entries(thread_pool, entries));
+    }
+
+    const auto total_weight = stream ? stream->get_total_weight() : get_total_weight(entries);
 
-    print_statistics(parameters, entries);
+    FeatureIndex feature_index;
+    if constexpr (use_feature_index)
+    {
+        build_feature_index(entries, parameter_count, feature_index);
+        print_elapsed(start);
+        cout << "Built feature index with " << feature_index.entry_indices.size() << " coefficients" << endl << endl;
+    }
 
     if constexpr (TuneEval::retune_from_zero)
     {
-        for (auto& parameter : parameters)
+        for (int32_t parameter_index = 0; parameter_index < parameter_count; parameter_index++)
         {
-#if TAPERED
-            parameter[static_cast<int>(PhaseStages::Midgame)] = static_cast<tune_t>(0);
-            parameter[static_cast<int>(PhaseStages::Endgame)] = static_cast<tune_t>(0);
-#else
-            parameter = static_cast<tune_t>(0);
-#endif            
+            // Frozen parameters keep the values which were folded into the entries
+            if (!frozen_mask.empty() && frozen_mask[parameter_index])
+            {
+                continue;
+            }
+
+            parameters[parameter_index] = Phase::parameter_t{};
         }
     }
 
@@ -866,7 +2811,7 @@ void Tuner::run(const std::vector<DataSource>& sources)
     if constexpr (TuneEval::preferred_k <= 0)
     {
         cout << "Finding optimal K..." << endl;
-        K = find_optimal_k(thread_pool, entries, parameters);
+        K = find_optimal_k(thread_pool, entries, stream.get(), total_weight, wdl_deviation, parameters);
     }
     else
     {
@@ -875,65 +2820,245 @@ void Tuner::run(const std::vector<DataSource>& sources)
     }
     cout << "K = " << K << endl;
 
-    const auto avg_error = get_average_error(thread_pool, entries, parameters, K);
+    const auto avg_error = get_average_error(thread_pool, entries, stream.get(), total_weight, wdl_deviation, parameters, K);
     cout << "Initial error = " << avg_error << endl;
 
     const auto loop_start = high_resolution_clock::now();
     tune_t learning_rate = TuneEval::initial_learning_rate;
     int32_t max_tune_epoch = TuneEval::max_epoch;
-#if TAPERED
-    parameters_t momentum(parameters.size(), pair_t{});
-    parameters_t velocity(parameters.size(), pair_t{});
-#else
-    parameters_t momentum(parameters.size(), 0);
-    parameters_t velocity(parameters.size(), 0);
-#endif
+    StageArrays momentum;
+    StageArrays velocity;
+    // Parameters updated in the current epoch, a sliding block when doing coordinate descent
+    int32_t block_begin = 0;
+    int32_t block_end = parameter_count;
     for (int32_t epoch = 1; epoch < max_tune_epoch; epoch++)
     {
-#if TAPERED
-        parameters_t gradient(parameters.size(), pair_t{});
-#else
-        parameters_t gradient(parameters.size(), 0);
-#endif
+        TraceSpan span("epoch");
+        StageArrays gradient;
         
-        compute_gradient(thread_pool, gradient, entries, parameters, K);
+        // When streaming, the error is computed in the same pass over the shards as the gradient
+        const auto report_epoch = epoch % 100 == 0;
+        tune_t error_sum = 0;
+        parameters_t block_previous;
+        if constexpr (use_feature_index)
+        {
+            block_end = min(block_begin + coordinate_block_size, parameter_count);
+            if constexpr (use_eval_cache)
+            {
+                // Recomputed once per cycle through the parameters, so rounding errors of the updates don't build up
+                if (block_begin == 0)
+                {
+                    refresh_entry_evals(thread_pool, entries, feature_index, parameters);
+                }
+                block_previous.assign(parameters.begin() + block_begin, parameters.begin() + block_end);
+            }
+            compute_block_gradient(thread_pool, gradient, entries, feature_index, parameters, K, block_begin, block_end);
+        }
+        else
+        {
+            for_each_entry_shard(entries, stream.get(), [&](const vector<Entry>& shard)
+            {
+                compute_gradient(thread_pool, gradient, shard, parameters, K);
+                if (stream && report_epoch)
+                {
+                    error_sum += get_error_sum(thread_pool, shard, parameters, K);
+                }
+            });
+        }
 
-        constexpr tune_t beta1 = 0.9;
-        constexpr tune_t beta2 = 0.999;
+        adam_step(parameters, gradient, momentum, velocity, -K / static_cast<tune_t>(400) / total_weight, learning_rate, block_begin, block_end);
 
-        for (int parameter_index = 0; parameter_index < parameters.size(); parameter_index++) {
-#if TAPERED
-            for(int phase_stage = 0; phase_stage < 2; phase_stage++)
+        if constexpr (use_feature_index)
+        {
+            if constexpr (use_eval_cache)
             {
-                const tune_t grad = -K / static_cast<tune_t>(400) * gradient[parameter_index][phase_stage] / static_cast<tune_t>(entries.size());
-                momentum[parameter_index][phase_stage] = beta1 * momentum[parameter_index][phase_stage] + (1 - beta1) * grad;
-                velocity[parameter_index][phase_stage] = beta2 * velocity[parameter_index][phase_stage] + (1 - beta2) * pow(grad, 2);
-                parameters[parameter_index][phase_stage] -= learning_rate * momentum[parameter_index][phase_stage] / (static_cast<tune_t>(1e-8) + sqrt(velocity[parameter_index][phase_stage]));
+                update_entry_evals(thread_pool, entries, feature_index, parameters, block_previous, block_begin, block_end);
             }
-#else
-            const tune_t grad = -K / 400.0 * gradient[parameter_index] / static_cast<tune_t>(entries.size());
-            momentum[parameter_index] = beta1 * momentum[parameter_index] + (1 - beta1) * grad;
-            velocity[parameter_index] = beta2 * velocity[parameter_index] + (1 - beta2) * pow(grad, 2);
-            parameters[parameter_index] -= learning_rate * momentum[parameter_index] / (1e-8 + sqrt(velocity[parameter_index]));
-#endif
-            
+            block_begin = block_end == parameter_count ? 0 : block_end;
         }
 
-        if (epoch % 100 == 0)
+        if (report_epoch)
         {
             const auto elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - loop_start).count();
             const auto epochs_per_second = epoch * 1000.0 / elapsed_ms;
-            const tune_t error = get_average_error(thread_pool, entries, parameters, K);
+            const tune_t error = stream ? (error_sum + wdl_deviation) / total_weight : get_average_error(thread_pool, entries, nullptr, total_weight, wdl_deviation, parameters, K);
             print_elapsed(start);
             cout << "Epoch " << epoch << " (" << epochs_per_second << " eps), error " << error << ", LR " << learning_rate << endl;
             TuneEval::print_parameters(parameters);
         }
 
+        if (instrumentation_export_interval > 0 && epoch % instrumentation_export_interval == 0)
+        {
+            export_instrumentation(start);
+        }
+
         if(epoch % TuneEval::learning_rate_drop_interval == 0)
         {
             learning_rate *= TuneEval::learning_rate_drop_ratio;
         }
+
+        if constexpr (refresh_qsearch)
+        {
+            if (epoch % qsearch_refresh_interval == 0)
+            {
+                print_elapsed(start);
+                refresh_qsearch_entries(thread_pool, entries, qsearch_sources, parameters, initial_parameters);
+                if constexpr (use_feature_index)
+                {
+                    build_feature_index(entries, parameter_count, feature_index);
+                    if constexpr (use_eval_cache)
+                    {
+                        refresh_entry_evals(thread_pool, entries, feature_index, parameters);
+                    }
+                }
+            }
+        }
     }
 
+    export_instrumentation(start);
+    export_trace_events();
+    thread_pool.stop();
+}
+
+TuningBenchResult bench_tuning(const std::vector<DataSource>& sources, const TuningBenchOptions& options)
+{
+    TuningBenchResult result;
+    const auto start = high_resolution_clock::now();
+
+    ThreadPool thread_pool;
+    thread_pool.start(thread_count);
+
+    auto parameters = TuneEval::get_initial_parameters();
+    vector<Entry> entries;
+    vector<QuiescenceSource> qsearch_sources;
+    load_untapered_ranges(parameters);
+    load_frozen_mask(parameter_count);
+    load_sources(thread_pool, sources, parameters, start, entries, qsearch_sources, nullptr);
     thread_pool.stop();
+    result.load_seconds = duration<double>(high_resolution_clock::now() - start).count();
+    result.entries = static_cast<int64_t>(entries.size());
+
+    int64_t entry_bytes = 0;
+    for (const auto& entry : entries)
+    {
+        entry_bytes += sizeof(Entry) + entry.coefficients.capacity() * sizeof(CoefficientEntry);
+    }
+    result.bytes_per_entry = entries.empty() ? 0 : static_cast<double>(entry_bytes) / entries.size();
+    if (entries.empty())
+    {
+        return result;
+    }
+
+    // Times the full batch gradient path of run, with a fixed K so that only the epochs are measured
+    const tune_t K = TuneEval::preferred_k > 0 ? TuneEval::preferred_k : static_cast<tune_t>(2.5);
+    const auto total_weight = get_total_weight(entries);
+    const auto initial_parameters = parameters;
+    auto thread_counts = options.thread_counts;
+    if (thread_counts.empty())
+    {
+        for (int32_t threads = 1; threads < thread_count; threads *= 2)
+        {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(thread_count);
+    }
+
+    for (const auto threads : thread_counts)
+    {
+        if (threads < 1 || threads > thread_count)
+        {
+            continue;
+        }
+
+        thread_pool.start(threads);
+        parameters = initial_parameters;
+        StageArrays momentum;
+        StageArrays velocity;
+        const auto epochs_start = high_resolution_clock::now();
+        for (int32_t epoch = 0; epoch < options.epochs; epoch++)
+        {
+            StageArrays gradient;
+            compute_gradient(thread_pool, gradient, entries, parameters, K);
+            adam_step(parameters, gradient, momentum, velocity, -K / static_cast<tune_t>(400) / total_weight, TuneEval::initial_learning_rate, 0, parameter_count);
+        }
+        const auto seconds = duration<double>(high_resolution_clock::now() - epochs_start).count();
+        thread_pool.stop();
+        result.scaling.push_back({ threads, options.epochs / seconds });
+    }
+
+    return result;
+}
+
+void convert(const std::vector<DataSource>& sources, const std::string& output_path)
+{
+    const auto start = high_resolution_clock::now();
+    ofstream output(output_path, ios::binary);
+    if (!output)
+    {
+        cout << "Failed to open " << output_path << endl;
+        throw runtime_error("Failed to open conversion output");
+    }
+
+    int64_t total_count = 0;
+    for (const auto& source : sources)
+    {
+        if (source.format != DataSourceFormat::Epd)
+        {
+            cout << "Skipping " << source.path << ", only EPD data sources can be converted" << endl;
+            continue;
+        }
+
+        cout << "Converting " << source.path << "..." << endl;
+        ifstream file(source.path);
+        if (!file)
+        {
+            cout << "Failed to open " << source.path << endl;
+            throw runtime_error("Failed to open data source");
+        }
+
+        constexpr size_t batch_size = 1 << 16;
+        vector<PackedBoard> packed_boards;
+        packed_boards.reserve(batch_size);
+        int64_t source_count = 0;
+        chess::Board board;
+        string original_fen;
+        while (getline(file, original_fen))
+        {
+            if (source.position_limit > 0 && source_count >= source.position_limit)
+            {
+                break;
+            }
+
+            // Blank lines are skipped like the loader does
+            if (original_fen.ends_with('\r'))
+            {
+                original_fen.pop_back();
+            }
+            if (original_fen.empty())
+            {
+                continue;
+            }
+
+            const auto line = parse_fen_line(original_fen, source.side_to_move_wdl);
+            board.setFen(line.fen);
+
+            auto packed = pack_board(board);
+            packed.result = static_cast<uint8_t>(lround(line.wdl * packed_result_scale));
+            packed_boards.push_back(packed);
+            source_count++;
+
+            if (packed_boards.size() == batch_size)
+            {
+                output.write(reinterpret_cast<const char*>(packed_boards.data()), packed_boards.size() * sizeof(PackedBoard));
+                packed_boards.clear();
+            }
+        }
+
+        output.write(reinterpret_cast<const char*>(packed_boards.data()), packed_boards.size() * sizeof(PackedBoard));
+        total_count += source_count;
+    }
+
+    print_elapsed(start);
+    cout << "Wrote " << total_count << " positions to " << output_path << endl;
+}
 }
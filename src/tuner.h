@@ -7,14 +7,75 @@
 
 namespace Tuner
 {
+    enum class DataSourceFormat
+    {
+        Epd,
+        Pgn,
+        Packed
+    };
+
     struct DataSource
     {
         std::string path;
+        DataSourceFormat format = DataSourceFormat::Epd;
         bool side_to_move_wdl;
         int64_t position_limit;
     };
 
-    void run(const std::vector<DataSource>& sources);
+    // Which engine eval function a trace benchmark calls
+    enum class TracePath
+    {
+        Fen,
+        External
+    };
+
+    struct TraceBenchResult
+    {
+        // 0 if the engine doesn't support the path
+        int64_t positions = 0;
+        double seconds = 0;
+        // Sum of the coefficients weighted by their parameter index, to check that traces don't change
+        int64_t checksum = 0;
+    };
+
+    struct TuningBenchOptions
+    {
+        int32_t epochs = 20;
+        // Worker counts the epochs are timed with, each at most thread_count from config.h.
+        // If empty, doubling counts from 1 up to thread_count.
+        std::vector<int32_t> thread_counts;
+    };
+
+    struct TuningBenchResult
+    {
+        struct Scaling
+        {
+            int32_t threads;
+            double epochs_per_second;
+        };
+
+        int64_t entries = 0;
+        double load_seconds = 0;
+        // Entry and its coefficients, without the allocator's overhead
+        double bytes_per_entry = 0;
+        std::vector<Scaling> scaling;
+    };
+
+    // Tuner compiled for one engine, so that the engine's evaluation is statically dispatched
+    struct Engine
+    {
+        std::string name;
+        void (*run)(const std::vector<DataSource>& sources);
+        void (*convert)(const std::vector<DataSource>& sources, const std::string& output_path);
+        TraceBenchResult (*bench_traces)(const std::vector<std::string>& fens, int32_t iterations, TracePath path);
+        TuningBenchResult (*bench_tuning)(const std::vector<DataSource>& sources, const TuningBenchOptions& options);
+    };
+
+    // Reads the data source list, a CSV of path, side to move WDL flag and position limit. Returns 0 on success.
+    int read_sources(const std::string& csv_path, std::vector<DataSource>& sources);
+
+    const std::vector<Engine>& get_engines();
+    const Engine* find_engine(const std::string& name);
 }
 
 #endif // !TUNER_H